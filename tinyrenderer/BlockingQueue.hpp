@@ -0,0 +1,71 @@
+//
+//  BlockingQueue.hpp
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/12/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#ifndef BlockingQueue_hpp
+#define BlockingQueue_hpp
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+// FIFO for handing work between threads. push() blocks while the queue is full (which is what gives producers
+// backpressure) and pop() blocks while it's empty. After close(), pushes fail and pops drain what's left.
+template<typename T>
+class BlockingQueue {
+public:
+    // A capacity of 0 means unbounded
+    explicit BlockingQueue(size_t capacity = 0)
+    : m_capacity(capacity)
+    {
+    }
+
+    BlockingQueue(const BlockingQueue &) = delete;
+    BlockingQueue &operator=(const BlockingQueue &) = delete;
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [this]() { return m_isClosed || m_capacity == 0 || m_items.size() < m_capacity; });
+        if (m_isClosed) {
+            return false;
+        }
+        m_items.push_back(std::move(item));
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    // Returns false once the queue has been closed and everything in it popped
+    bool pop(T &outItem) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notEmpty.wait(lock, [this]() { return m_isClosed || !m_items.empty(); });
+        if (m_items.empty()) {
+            return false;
+        }
+        outItem = std::move(m_items.front());
+        m_items.pop_front();
+        m_notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_isClosed = true;
+        m_notEmpty.notify_all();
+        m_notFull.notify_all();
+    }
+
+private:
+    const size_t m_capacity;
+    bool m_isClosed = false;
+    std::deque<T> m_items;
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+};
+
+#endif /* BlockingQueue_hpp */
@@ -0,0 +1,71 @@
+//
+//  BoundingBox.hpp
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/9/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#ifndef BoundingBox_hpp
+#define BoundingBox_hpp
+
+#include <algorithm>
+#include <limits>
+
+#include "Vector.hpp"
+
+// Axis-aligned bounding box. A default-constructed box is empty (min > max) so that growing it by the first point
+// gives a box around just that point.
+struct BoundingBox {
+    Vector3f min;
+    Vector3f max;
+
+    BoundingBox()
+    : min( std::numeric_limits<float>::max(),    std::numeric_limits<float>::max(),    std::numeric_limits<float>::max())
+    , max(std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest())
+    {
+    }
+
+    bool isEmpty() const {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    void grow(const Vector3f &point) {
+        for (int axis = 0; axis < 3; ++axis) {
+            min[axis] = std::min(min[axis], point[axis]);
+            max[axis] = std::max(max[axis], point[axis]);
+        }
+    }
+
+    void grow(const BoundingBox &other) {
+        if (other.isEmpty()) {
+            return;
+        }
+        grow(other.min);
+        grow(other.max);
+    }
+
+    Vector3f extent() const {
+        return max - min;
+    }
+
+    Vector3f center() const {
+        return Vector3f((min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f, (min.z + max.z) * 0.5f);
+    }
+
+    float surfaceArea() const {
+        if (isEmpty()) {
+            return 0.f;
+        }
+        Vector3f size = extent();
+        return 2.f * (size.x*size.y + size.y*size.z + size.z*size.x);
+    }
+
+    int longestAxis() const {
+        Vector3f size = extent();
+        if (size.x >= size.y && size.x >= size.z) return 0;
+        return (size.y >= size.z) ? 1 : 2;
+    }
+};
+
+#endif /* BoundingBox_hpp */
@@ -0,0 +1,392 @@
+//
+//  ChunkedMesh.cpp
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/14/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#include "ChunkedMesh.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char ChunkedMeshMagic[4] = { 'T', 'R', 'C', 'M' };
+static const uint32_t ChunkedMeshVersion = 1;
+
+// Faces go to and from disk as-is
+static_assert(sizeof(ModelFace) == 6 * sizeof(int32_t), "ModelFace must be six packed 32-bit indices");
+
+static void copyBounds(const BoundingBox &bounds, float outMin[3], float outMax[3]) {
+    for (int axis = 0; axis < 3; ++axis) {
+        outMin[axis] = bounds.min[axis];
+        outMax[axis] = bounds.max[axis];
+    }
+}
+
+static BoundingBox makeBounds(const float min[3], const float max[3]) {
+    BoundingBox bounds;
+    bounds.grow(Vector3f(min[0], min[1], min[2]));
+    bounds.grow(Vector3f(max[0], max[1], max[2]));
+    return bounds;
+}
+
+// Reads the records at the given (sorted, unique) indices from a scratch file of fixed-size float records.
+// Indices that are close together are covered by one bulk read of everything between them, and the records are
+// picked out of that; seeking for each record would throw the stream's buffer away every time.
+static bool readScratchRecords(std::ifstream &stream, const std::vector<int> &sortedIndices, int floatsPerRecord, std::vector<float> &outFloats) {
+    // Reading through a gap this size is cheaper than seeking over it
+    const int MaxRecordsSkipped = 1024;
+    // Keeps the window buffer small however spread out a chunk's vertices are
+    const int MaxWindowRecords = 65536;
+
+    outFloats.resize(sortedIndices.size() * floatsPerRecord);
+    const std::streamoff recordSize = floatsPerRecord * sizeof(float);
+    std::vector<float> window;
+    size_t first = 0;
+    while (first < sortedIndices.size()) {
+        const int windowStart = sortedIndices[first];
+        size_t end = first + 1;
+        while (end < sortedIndices.size()
+               && sortedIndices[end] - sortedIndices[end - 1] <= MaxRecordsSkipped
+               && sortedIndices[end] - windowStart < MaxWindowRecords) {
+            ++end;
+        }
+
+        const size_t windowSize = sortedIndices[end - 1] - windowStart + 1;
+        window.resize(windowSize * floatsPerRecord);
+        stream.seekg(windowStart * recordSize);
+        stream.read(reinterpret_cast<char*>(window.data()), windowSize * recordSize);
+        if (!stream.good()) {
+            return false;
+        }
+        for (size_t i = first; i < end; ++i) {
+            const float* record = &window[(sortedIndices[i] - windowStart) * floatsPerRecord];
+            std::copy(record, record + floatsPerRecord, &outFloats[i * floatsPerRecord]);
+        }
+        first = end;
+    }
+    return true;
+}
+
+// Collects the distinct indices used by the faces (through indexMember), sorted
+static std::vector<int> getUsedIndices(const std::vector<ModelFace> &faces, int ModelVertex::*indexMember) {
+    std::vector<int> indices;
+    indices.reserve(faces.size() * 3);
+    for (const ModelFace &face : faces) {
+        for (int i = 0; i < 3; ++i) {
+            indices.push_back(face.vertices[i].*indexMember);
+        }
+    }
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+    return indices;
+}
+
+// Creates an empty file whose name is pathPrefix plus a unique suffix and returns its path, or "" if it can't
+static std::string createUniqueFile(const std::string &pathPrefix) {
+    std::string pathTemplate = pathPrefix + "XXXXXX";
+    std::vector<char> path(pathTemplate.begin(), pathTemplate.end());
+    path.push_back('\0');
+    const int file = mkstemp(path.data());
+    if (file < 0) {
+        return "";
+    }
+    close(file);
+    return path.data();
+}
+
+// Creates an empty file with a unique name in $TMPDIR (or /tmp) and returns its path, or "" if it can't.
+// Scratch data goes there rather than next to the output, which may be on a slow or read-only volume.
+static std::string createScratchFile(const std::string &tag) {
+    const char* tempDirectory = getenv("TMPDIR");
+    return createUniqueFile(std::string((tempDirectory && *tempDirectory) ? tempDirectory : "/tmp") + "/tinyrenderer-" + tag + "-");
+}
+
+static int getLocalIndex(const std::vector<int> &sortedGlobalIndices, int globalIndex) {
+    return static_cast<int>(std::lower_bound(sortedGlobalIndices.begin(), sortedGlobalIndices.end(), globalIndex) - sortedGlobalIndices.begin());
+}
+
+static bool writeChunks(std::ifstream &facesIn, std::ifstream &positionsIn, std::ifstream &texCoordsIn, size_t numVertices, size_t numTexCoords, size_t facesPerChunk, std::ofstream &out) {
+    // Filled in properly once all the chunks are written. Until then there's no magic, so a conversion that gets
+    // interrupted leaves a file that ChunkedMeshReader won't open.
+    ChunkedMeshHeader header = {};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    BoundingBox meshBounds;
+    std::vector<ModelFace> faces(facesPerChunk);
+    std::vector<float> positions;
+    std::vector<float> texCoords;
+    while (true) {
+        faces.resize(facesPerChunk);
+        facesIn.read(reinterpret_cast<char*>(faces.data()), facesPerChunk * sizeof(ModelFace));
+        const size_t numFacesRead = static_cast<size_t>(facesIn.gcount()) / sizeof(ModelFace);
+        if (numFacesRead == 0) {
+            break;
+        }
+        faces.resize(numFacesRead);
+
+        for (const ModelFace &face : faces) {
+            for (int i = 0; i < 3; ++i) {
+                const ModelVertex &corner = face.vertices[i];
+                if (corner.positionIndex < 0 || static_cast<size_t>(corner.positionIndex) >= numVertices
+                    || corner.texCoordIndex < 0 || static_cast<size_t>(corner.texCoordIndex) >= numTexCoords) {
+                    std::cout << "Face refers to a vertex or texture coordinate that doesn't exist" << std::endl;
+                    return false;
+                }
+            }
+        }
+
+        const std::vector<int> positionIndices = getUsedIndices(faces, &ModelVertex::positionIndex);
+        const std::vector<int> texCoordIndices = getUsedIndices(faces, &ModelVertex::texCoordIndex);
+        if (!readScratchRecords(positionsIn, positionIndices, 3, positions) || !readScratchRecords(texCoordsIn, texCoordIndices, 2, texCoords)) {
+            std::cout << "Failed to read back scratch data" << std::endl;
+            return false;
+        }
+        for (ModelFace &face : faces) {
+            for (int i = 0; i < 3; ++i) {
+                face.vertices[i].positionIndex = getLocalIndex(positionIndices, face.vertices[i].positionIndex);
+                face.vertices[i].texCoordIndex = getLocalIndex(texCoordIndices, face.vertices[i].texCoordIndex);
+            }
+        }
+
+        BoundingBox chunkBounds;
+        for (size_t i = 0; i < positionIndices.size(); ++i) {
+            chunkBounds.grow(Vector3f(positions[i*3], positions[i*3 + 1], positions[i*3 + 2]));
+        }
+        meshBounds.grow(chunkBounds);
+
+        MeshChunkHeader chunkHeader;
+        copyBounds(chunkBounds, chunkHeader.boundsMin, chunkHeader.boundsMax);
+        chunkHeader.numVertices = static_cast<uint32_t>(positionIndices.size());
+        chunkHeader.numTexCoords = static_cast<uint32_t>(texCoordIndices.size());
+        chunkHeader.numFaces = static_cast<uint32_t>(faces.size());
+        out.write(reinterpret_cast<const char*>(&chunkHeader), sizeof(chunkHeader));
+        out.write(reinterpret_cast<const char*>(positions.data()), positions.size() * sizeof(float));
+        out.write(reinterpret_cast<const char*>(texCoords.data()), texCoords.size() * sizeof(float));
+        out.write(reinterpret_cast<const char*>(faces.data()), faces.size() * sizeof(ModelFace));
+        if (!out.good()) {
+            std::cout << "Failed to write chunk" << std::endl;
+            return false;
+        }
+
+        header.numChunks++;
+        header.numFaces += faces.size();
+    }
+
+    memcpy(header.magic, ChunkedMeshMagic, sizeof(header.magic));
+    header.version = ChunkedMeshVersion;
+    copyBounds(meshBounds, header.boundsMin, header.boundsMax);
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    return out.good();
+}
+
+bool convertObjToChunkedMesh(const std::string &objPath, const std::string &chunkedMeshPath, size_t facesPerChunk) {
+    std::ifstream objStream(objPath);
+    if (!objStream.is_open()) {
+        std::cout << "Failed to open file: " << objPath << std::endl;
+        return false;
+    }
+
+    const std::string positionsPath = createScratchFile("positions");
+    const std::string texCoordsPath = createScratchFile("texcoords");
+    const std::string facesPath = createScratchFile("faces");
+
+    // Pass 1: spill everything to flat binary files so that vertices can be looked up by index later
+    size_t numVertices = 0;
+    size_t numTexCoords = 0;
+    bool didSpill;
+    {
+        std::ofstream positionsOut(positionsPath, std::ios::binary);
+        std::ofstream texCoordsOut(texCoordsPath, std::ios::binary);
+        std::ofstream facesOut(facesPath, std::ios::binary);
+
+        std::string nextLine;
+        didSpill = positionsOut.is_open() && texCoordsOut.is_open() && facesOut.is_open();
+        while (didSpill && std::getline(objStream, nextLine)) {
+            ObjLine line = parseObjLine(nextLine);
+            switch (line.type) {
+                case ObjLine::Vertex:
+                    positionsOut.write(reinterpret_cast<const char*>(line.vertex.raw), 3 * sizeof(float));
+                    ++numVertices;
+                    break;
+                case ObjLine::TexCoord:
+                    texCoordsOut.write(reinterpret_cast<const char*>(line.texCoord.raw), 2 * sizeof(float));
+                    ++numTexCoords;
+                    break;
+                case ObjLine::Face:
+                    facesOut.write(reinterpret_cast<const char*>(&line.face), sizeof(ModelFace));
+                    break;
+                case ObjLine::Other:
+                    break;
+            }
+        }
+        didSpill = didSpill && positionsOut.good() && texCoordsOut.good() && facesOut.good();
+        if (!didSpill) {
+            std::cout << "Failed to write scratch files for " << objPath << std::endl;
+        }
+    }
+
+    // Pass 2: cut the faces into chunks, gathering each chunk's vertices back from the scratch files. The output is
+    // written to a file of its own next to chunkedMeshPath and renamed over it once complete, so that a reader, or
+    // another conversion of the same model, never sees it half written.
+    bool didSucceed = false;
+    std::string outputPath;
+    if (didSpill) {
+        outputPath = createUniqueFile(chunkedMeshPath + ".tmp-");
+        std::ifstream facesIn(facesPath, std::ios::binary);
+        std::ifstream positionsIn(positionsPath, std::ios::binary);
+        std::ifstream texCoordsIn(texCoordsPath, std::ios::binary);
+        std::ofstream out;
+        if (!outputPath.empty()) {
+            out.open(outputPath, std::ios::binary);
+        }
+        if (!out.is_open()) {
+            std::cout << "Failed to create a file next to: " << chunkedMeshPath << std::endl;
+        } else {
+            didSucceed = writeChunks(facesIn, positionsIn, texCoordsIn, numVertices, numTexCoords, std::max<size_t>(facesPerChunk, 1), out);
+            out.close();
+            didSucceed = didSucceed && !out.fail();
+        }
+    }
+
+    if (didSucceed) {
+        // mkstemp makes the file readable by its owner only; give it the permissions a plain ofstream would have
+        const mode_t mask = umask(0);
+        umask(mask);
+        chmod(outputPath.c_str(), 0666 & ~mask);
+        if (std::rename(outputPath.c_str(), chunkedMeshPath.c_str()) != 0) {
+            std::cout << "Failed to write file: " << chunkedMeshPath << std::endl;
+            didSucceed = false;
+        }
+    }
+
+    std::remove(positionsPath.c_str());
+    std::remove(texCoordsPath.c_str());
+    std::remove(facesPath.c_str());
+    if (!didSucceed && !outputPath.empty()) {
+        std::remove(outputPath.c_str());
+    }
+    return didSucceed;
+}
+
+bool isChunkedMeshUpToDate(const std::string &objPath, const std::string &chunkedMeshPath) {
+    struct stat objInfo;
+    struct stat chunkedMeshInfo;
+    if (stat(objPath.c_str(), &objInfo) != 0 || stat(chunkedMeshPath.c_str(), &chunkedMeshInfo) != 0
+        || chunkedMeshInfo.st_mtime <= objInfo.st_mtime) {
+        return false;
+    }
+    // A conversion that didn't finish leaves a file without a valid header
+    std::ifstream stream(chunkedMeshPath, std::ios::binary);
+    ChunkedMeshHeader header = {};
+    stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+    return stream.good() && memcmp(header.magic, ChunkedMeshMagic, sizeof(header.magic)) == 0 && header.version == ChunkedMeshVersion;
+}
+
+bool ChunkedMeshReader::open(const std::string &filePath) {
+    m_stream.close();
+    m_stream.clear();
+    m_stream.open(filePath, std::ios::binary);
+    if (!m_stream.is_open()) {
+        std::cout << "Failed to open file: " << filePath << std::endl;
+        return false;
+    }
+
+    m_stream.read(reinterpret_cast<char*>(&m_header), sizeof(m_header));
+    if (!m_stream.good() || memcmp(m_header.magic, ChunkedMeshMagic, sizeof(m_header.magic)) != 0 || m_header.version != ChunkedMeshVersion) {
+        std::cout << "Not a chunked mesh file: " << filePath << std::endl;
+        m_header = ChunkedMeshHeader();
+        m_stream.close();
+        return false;
+    }
+
+    m_firstChunkPosition = m_stream.tellg();
+    m_nextChunkIndex = 0;
+    return true;
+}
+
+BoundingBox ChunkedMeshReader::bounds() const {
+    return (m_header.numChunks > 0) ? makeBounds(m_header.boundsMin, m_header.boundsMax) : BoundingBox();
+}
+
+BoundingBox ChunkedMeshReader::chunkBounds(const MeshChunkHeader &chunkHeader) {
+    return makeBounds(chunkHeader.boundsMin, chunkHeader.boundsMax);
+}
+
+void ChunkedMeshReader::rewind() {
+    m_stream.clear();
+    m_stream.seekg(m_firstChunkPosition);
+    m_nextChunkIndex = 0;
+}
+
+bool ChunkedMeshReader::readChunkHeader(MeshChunkHeader &outChunkHeader) {
+    if (!m_stream.is_open() || m_nextChunkIndex >= m_header.numChunks) {
+        return false;
+    }
+
+    m_stream.read(reinterpret_cast<char*>(&outChunkHeader), sizeof(outChunkHeader));
+    if (!m_stream.good()) {
+        std::cout << "Failed to read chunk header" << std::endl;
+        return false;
+    }
+    // Every vertex and texture coordinate in a chunk is used by at least one of its faces
+    if (outChunkHeader.numVertices > 3ull * outChunkHeader.numFaces || outChunkHeader.numTexCoords > 3ull * outChunkHeader.numFaces) {
+        std::cout << "Corrupt chunk header" << std::endl;
+        return false;
+    }
+
+    ++m_nextChunkIndex;
+    return true;
+}
+
+bool ChunkedMeshReader::readChunk(const MeshChunkHeader &chunkHeader, ObjModel &outChunk) {
+    std::vector<float> positionData(chunkHeader.numVertices * 3);
+    std::vector<float> texCoordData(chunkHeader.numTexCoords * 2);
+    std::vector<ModelFace> faces(chunkHeader.numFaces);
+    m_stream.read(reinterpret_cast<char*>(positionData.data()), positionData.size() * sizeof(float));
+    m_stream.read(reinterpret_cast<char*>(texCoordData.data()), texCoordData.size() * sizeof(float));
+    m_stream.read(reinterpret_cast<char*>(faces.data()), faces.size() * sizeof(ModelFace));
+    if (!m_stream.good()) {
+        std::cout << "Failed to read chunk" << std::endl;
+        return false;
+    }
+
+    for (const ModelFace &face : faces) {
+        for (int i = 0; i < 3; ++i) {
+            const ModelVertex &corner = face.vertices[i];
+            if (corner.positionIndex < 0 || static_cast<uint32_t>(corner.positionIndex) >= chunkHeader.numVertices
+                || corner.texCoordIndex < 0 || static_cast<uint32_t>(corner.texCoordIndex) >= chunkHeader.numTexCoords) {
+                std::cout << "Corrupt chunk: face index out of range" << std::endl;
+                return false;
+            }
+        }
+    }
+
+    std::vector<Vector3f> vertices(chunkHeader.numVertices);
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        vertices[i] = Vector3f(positionData[i*3], positionData[i*3 + 1], positionData[i*3 + 2]);
+    }
+    std::vector<Vector2f> textureCoordinates(chunkHeader.numTexCoords);
+    for (size_t i = 0; i < textureCoordinates.size(); ++i) {
+        textureCoordinates[i] = Vector2f(texCoordData[i*2], texCoordData[i*2 + 1]);
+    }
+    outChunk = ObjModel(std::move(vertices), std::move(textureCoordinates), std::move(faces));
+    return true;
+}
+
+bool ChunkedMeshReader::skipChunk(const MeshChunkHeader &chunkHeader) {
+    const std::streamoff chunkSize = chunkHeader.numVertices * 3 * sizeof(float)
+                                   + chunkHeader.numTexCoords * 2 * sizeof(float)
+                                   + chunkHeader.numFaces * sizeof(ModelFace);
+    m_stream.seekg(chunkSize, std::ios::cur);
+    return m_stream.good();
+}
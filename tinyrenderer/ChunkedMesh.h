@@ -0,0 +1,85 @@
+//
+//  ChunkedMesh.h
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/14/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#ifndef ChunkedMesh_hpp
+#define ChunkedMesh_hpp
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include "BoundingBox.hpp"
+#include "ObjModel.h"
+
+// A binary mesh format for models too big to hold in memory at once. The faces are split into chunks, and each
+// chunk carries its own copy of the vertices and texture coordinates it uses (with chunk-local indices), so any
+// chunk can be loaded as a standalone ObjModel, drawn, and thrown away.
+//
+// Layout: a ChunkedMeshHeader, then per chunk a MeshChunkHeader followed by its vertices (3 floats each),
+// texture coordinates (2 floats each) and faces (position index, texture coordinate index for each of the
+// three corners, as int32s). Everything is in the writing machine's byte order.
+
+#pragma pack(push,1)
+struct ChunkedMeshHeader {
+    char magic[4]; // "TRCM"
+    uint32_t version;
+    uint32_t numChunks;
+    uint32_t reserved;
+    uint64_t numFaces;
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+struct MeshChunkHeader {
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t numVertices;
+    uint32_t numTexCoords;
+    uint32_t numFaces;
+};
+#pragma pack(pop)
+
+// Converts an OBJ file of any size. Memory use is bounded by facesPerChunk, not by the size of the model:
+// vertices, texture coordinates and faces are first spilled to scratch files in $TMPDIR (or /tmp), and each
+// chunk then reads back just the vertices it needs. The result replaces chunkedMeshPath in one rename, so a
+// failed or concurrent conversion never leaves a partial file there.
+bool convertObjToChunkedMesh(const std::string &objPath, const std::string &chunkedMeshPath, size_t facesPerChunk);
+
+// True if chunkedMeshPath holds a complete chunked mesh that is no older than objPath, so it can be used instead
+// of converting again
+bool isChunkedMeshUpToDate(const std::string &objPath, const std::string &chunkedMeshPath);
+
+class ChunkedMeshReader {
+public:
+    ChunkedMeshReader() = default;
+
+    bool open(const std::string &filePath);
+
+    size_t numChunks() const { return m_header.numChunks; }
+    size_t numFaces() const { return static_cast<size_t>(m_header.numFaces); }
+    BoundingBox bounds() const;
+
+    // Goes back to the first chunk, e.g. for a second pass over the model
+    void rewind();
+
+    // Reads the header of the next chunk. Returns false after the last one, or if the file is bad.
+    // Follow it with either readChunk() or skipChunk().
+    bool readChunkHeader(MeshChunkHeader &outChunkHeader);
+    bool readChunk(const MeshChunkHeader &chunkHeader, ObjModel &outChunk);
+    bool skipChunk(const MeshChunkHeader &chunkHeader);
+
+    static BoundingBox chunkBounds(const MeshChunkHeader &chunkHeader);
+
+private:
+    std::ifstream m_stream;
+    ChunkedMeshHeader m_header = {};
+    std::streampos m_firstChunkPosition;
+    size_t m_nextChunkIndex = 0;
+};
+
+#endif /* ChunkedMesh_hpp */
@@ -0,0 +1,122 @@
+//
+//  CompactModel.cpp
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/15/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#include "CompactModel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+static const float QuantizedMax = std::numeric_limits<uint16_t>::max();
+
+static uint16_t quantize(float value, float offset, float scale) {
+    if (scale <= 0.f) {
+        return 0;
+    }
+    float steps = std::round((value - offset) / scale);
+    return static_cast<uint16_t>(std::min(std::max(steps, 0.f), QuantizedMax));
+}
+
+CompactModel::CompactModel(const ObjModel &model)
+: m_bounds(model.bounds())
+{
+    // Dequantizing is offset + q * scale, so the scale is the size of one step
+    const Vector3f extent = m_bounds.isEmpty() ? Vector3f(0, 0, 0) : m_bounds.extent();
+    m_positionScale = Vector3f(extent.x / QuantizedMax, extent.y / QuantizedMax, extent.z / QuantizedMax);
+    m_positions.resize(model.numVertices() * 3);
+    for (size_t i = 0; i < model.numVertices(); ++i) {
+        const Vector3f vertex = model.vertexAtIndex(static_cast<int>(i));
+        for (int axis = 0; axis < 3; ++axis) {
+            m_positions[i*3 + axis] = quantize(vertex[axis], m_bounds.min[axis], m_positionScale[axis]);
+        }
+    }
+
+    Vector2f texCoordMin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+    Vector2f texCoordMax(std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest());
+    for (size_t i = 0; i < model.numTexCoords(); ++i) {
+        const Vector2f texCoord = model.texCoordAtIndex(static_cast<int>(i));
+        for (int axis = 0; axis < 2; ++axis) {
+            texCoordMin.raw[axis] = std::min(texCoordMin.raw[axis], texCoord.raw[axis]);
+            texCoordMax.raw[axis] = std::max(texCoordMax.raw[axis], texCoord.raw[axis]);
+        }
+    }
+    // Keep the usual [0,1] range exact, so that texel centres stay where they were
+    m_texCoordOffset = Vector2f(std::min(texCoordMin.u, 0.f), std::min(texCoordMin.v, 0.f));
+    m_texCoordScale = Vector2f((std::max(texCoordMax.u, 1.f) - m_texCoordOffset.u) / QuantizedMax,
+                               (std::max(texCoordMax.v, 1.f) - m_texCoordOffset.v) / QuantizedMax);
+    m_texCoords.resize(model.numTexCoords() * 2);
+    for (size_t i = 0; i < model.numTexCoords(); ++i) {
+        const Vector2f texCoord = model.texCoordAtIndex(static_cast<int>(i));
+        for (int axis = 0; axis < 2; ++axis) {
+            m_texCoords[i*2 + axis] = quantize(texCoord.raw[axis], m_texCoordOffset.raw[axis], m_texCoordScale.raw[axis]);
+        }
+    }
+
+    const size_t largestIndex = std::max(model.numVertices(), model.numTexCoords());
+    const bool useShortIndices = largestIndex <= static_cast<size_t>(std::numeric_limits<uint16_t>::max()) + 1;
+    const size_t numIndices = model.numFaces() * 6;
+    if (useShortIndices) {
+        m_shortIndices.reserve(numIndices);
+    } else {
+        m_longIndices.reserve(numIndices);
+    }
+    for (size_t faceIndex = 0; faceIndex < model.numFaces(); ++faceIndex) {
+        const ModelFace face = model.faceAtIndex(static_cast<int>(faceIndex));
+        for (int i = 0; i < 3; ++i) {
+            const ModelVertex &corner = face.vertices[i];
+            if (useShortIndices) {
+                m_shortIndices.push_back(static_cast<uint16_t>(corner.positionIndex));
+                m_shortIndices.push_back(static_cast<uint16_t>(corner.texCoordIndex));
+            } else {
+                m_longIndices.push_back(static_cast<uint32_t>(corner.positionIndex));
+                m_longIndices.push_back(static_cast<uint32_t>(corner.texCoordIndex));
+            }
+        }
+    }
+}
+
+size_t CompactModel::numFaces() const {
+    return (m_shortIndices.empty() ? m_longIndices.size() : m_shortIndices.size()) / 6;
+}
+
+Vector3f CompactModel::vertexAtIndex(int index) const {
+    assert(index >= 0 && static_cast<size_t>(index) < numVertices());
+    const uint16_t* quantized = &m_positions[index * 3];
+    return Vector3f(m_bounds.min.x + quantized[0] * m_positionScale.x,
+                    m_bounds.min.y + quantized[1] * m_positionScale.y,
+                    m_bounds.min.z + quantized[2] * m_positionScale.z);
+}
+
+Vector2f CompactModel::texCoordAtIndex(int index) const {
+    assert(index >= 0 && static_cast<size_t>(index) < numTexCoords());
+    const uint16_t* quantized = &m_texCoords[index * 2];
+    return Vector2f(m_texCoordOffset.u + quantized[0] * m_texCoordScale.u,
+                    m_texCoordOffset.v + quantized[1] * m_texCoordScale.v);
+}
+
+ModelFace CompactModel::faceAtIndex(int index) const {
+    assert(index >= 0 && static_cast<size_t>(index) < numFaces());
+    ModelFace face;
+    for (int i = 0; i < 3; ++i) {
+        const size_t firstIndex = (index * 6) + (i * 2);
+        if (m_shortIndices.empty()) {
+            face.vertices[i].positionIndex = static_cast<int>(m_longIndices[firstIndex]);
+            face.vertices[i].texCoordIndex = static_cast<int>(m_longIndices[firstIndex + 1]);
+        } else {
+            face.vertices[i].positionIndex = m_shortIndices[firstIndex];
+            face.vertices[i].texCoordIndex = m_shortIndices[firstIndex + 1];
+        }
+    }
+    return face;
+}
+
+size_t CompactModel::memoryUsage() const {
+    return (m_positions.size() + m_texCoords.size() + m_shortIndices.size()) * sizeof(uint16_t)
+         + m_longIndices.size() * sizeof(uint32_t);
+}
@@ -0,0 +1,55 @@
+//
+//  CompactModel.h
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/15/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#ifndef CompactModel_hpp
+#define CompactModel_hpp
+
+#include <cstdint>
+#include <vector>
+
+#include "BoundingBox.hpp"
+#include "ObjModel.h"
+#include "Vector.hpp"
+
+// A read-only, quantized copy of an ObjModel for rendering. Positions are stored as 16 bits per component
+// relative to the model's bounding box, texture coordinates as 16 bits per component relative to their own range
+// (which for the usual [0,1] atlas is plain unorm16), and indices as 16 bits whenever there are few enough
+// vertices. That's 6 bytes per vertex, 4 per texture coordinate and 12 per face instead of 12, 8 and 24.
+//
+// The accessors match ObjModel's and dequantize on the fly, so the same draw code works on either. Quantization
+// moves positions by at most half a step, i.e. extent / 131070 on each axis.
+class CompactModel {
+public:
+    CompactModel() = default;
+    explicit CompactModel(const ObjModel &model);
+
+    size_t numFaces() const;
+    size_t numVertices() const { return m_positions.size() / 3; }
+    size_t numTexCoords() const { return m_texCoords.size() / 2; }
+    BoundingBox bounds() const { return m_bounds; }
+    Vector3f vertexAtIndex(int index) const;
+    Vector2f texCoordAtIndex(int index) const;
+    ModelFace faceAtIndex(int index) const;
+
+    // Bytes used by the vertex, texture coordinate and index arrays
+    size_t memoryUsage() const;
+
+private:
+    BoundingBox m_bounds;
+    Vector3f m_positionScale;
+    Vector2f m_texCoordOffset;
+    Vector2f m_texCoordScale;
+
+    std::vector<uint16_t> m_positions; // x, y, z per vertex
+    std::vector<uint16_t> m_texCoords; // u, v per texture coordinate
+    // Position and texture coordinate index for each corner, six per face. Only one of these is used.
+    std::vector<uint16_t> m_shortIndices;
+    std::vector<uint32_t> m_longIndices;
+};
+
+#endif /* CompactModel_hpp */
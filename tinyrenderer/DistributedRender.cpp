@@ -0,0 +1,187 @@
+//
+//  DistributedRender.cpp
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/19/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#include "DistributedRender.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "SocketIO.h"
+
+// Samples [first, end) of the layer: all of the depths, then all of the colours
+static bool sendSamples(int socket, const DepthLayer &layer, size_t first, size_t end) {
+    return writeAll(socket, &layer.depths[first], (end - first) * sizeof(float))
+        && writeAll(socket, &layer.colors[first], (end - first) * sizeof(uint32_t));
+}
+
+static bool receiveSamples(int socket, DepthLayer &outLayer, size_t first, size_t end) {
+    return readAll(socket, &outLayer.depths[first], (end - first) * sizeof(float))
+        && readAll(socket, &outLayer.colors[first], (end - first) * sizeof(uint32_t));
+}
+
+static size_t getStripStart(size_t numSamples, int stripIndex, int numStrips) {
+    return numSamples * stripIndex / numStrips;
+}
+
+// Everything a worker does after forking. Never returns.
+static void runWorker(int workerIndex, int numWorkers, size_t numSamples, const RenderPartFunction &renderPart, const std::vector<int> &peerSockets, int parentSocket) {
+    DepthLayer layer;
+    if (!renderPart(workerIndex, numWorkers, layer) || layer.depths.size() != numSamples || layer.colors.size() != numSamples) {
+        std::cerr << "Worker " << workerIndex << " failed to render" << std::endl;
+        _exit(1);
+    }
+
+    const size_t stripStart = getStripStart(numSamples, workerIndex, numWorkers);
+    const size_t stripEnd = getStripStart(numSamples, workerIndex + 1, numWorkers);
+
+    // In round r, worker i sends to worker i + r while receiving from worker i - r, so every send in a round has
+    // a matching receive and no pair of workers can end up waiting on each other
+    bool didSendAll = true;
+    std::thread sender([&]() {
+        for (int round = 1; round < numWorkers && didSendAll; ++round) {
+            const int peer = (workerIndex + round) % numWorkers;
+            didSendAll = sendSamples(peerSockets[peer], layer,
+                                     getStripStart(numSamples, peer, numWorkers), getStripStart(numSamples, peer + 1, numWorkers));
+        }
+    });
+
+    // This worker's strip as drawn by every worker, indexed by worker
+    const size_t stripSize = stripEnd - stripStart;
+    std::vector<DepthLayer> strips(numWorkers);
+    bool didReceiveAll = true;
+    for (int round = 1; round < numWorkers && didReceiveAll; ++round) {
+        const int peer = (workerIndex - round + numWorkers) % numWorkers;
+        strips[peer].depths.resize(stripSize);
+        strips[peer].colors.resize(stripSize);
+        didReceiveAll = receiveSamples(peerSockets[peer], strips[peer], 0, stripSize);
+    }
+    sender.join();
+    if (!didSendAll || !didReceiveAll) {
+        std::cerr << "Worker " << workerIndex << " lost contact with another worker" << std::endl;
+        _exit(1);
+    }
+    strips[workerIndex].depths.assign(layer.depths.begin() + stripStart, layer.depths.begin() + stripEnd);
+    strips[workerIndex].colors.assign(layer.colors.begin() + stripStart, layer.colors.begin() + stripEnd);
+
+    // Going through the workers in order with >= lets later ones win ties
+    DepthLayer &composite = strips[0];
+    for (int worker = 1; worker < numWorkers; ++worker) {
+        const DepthLayer &strip = strips[worker];
+        for (size_t sample = 0; sample < stripSize; ++sample) {
+            if (strip.depths[sample] >= composite.depths[sample]) {
+                composite.depths[sample] = strip.depths[sample];
+                composite.colors[sample] = strip.colors[sample];
+            }
+        }
+    }
+
+    _exit(sendSamples(parentSocket, composite, 0, stripSize) ? 0 : 1);
+}
+
+bool renderDistributed(int numWorkers, size_t numSamples, const RenderPartFunction &renderPart, DepthLayer &outComposite) {
+    if (numWorkers < 1) {
+        return false;
+    }
+
+    // peerSockets[i][j] is worker i's end of its connection to worker j
+    std::vector<std::vector<int>> peerSockets(numWorkers, std::vector<int>(numWorkers, -1));
+    std::vector<int> parentSockets(numWorkers, -1);
+    std::vector<int> workerSockets(numWorkers, -1);
+    std::vector<int> allSockets;
+    bool didCreateSockets = true;
+    for (int i = 0; i < numWorkers && didCreateSockets; ++i) {
+        for (int j = i + 1; j < numWorkers && didCreateSockets; ++j) {
+            int pair[2];
+            didCreateSockets = (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+            if (didCreateSockets) {
+                peerSockets[i][j] = pair[0];
+                peerSockets[j][i] = pair[1];
+                allSockets.insert(allSockets.end(), pair, pair + 2);
+            }
+        }
+        if (!didCreateSockets) {
+            break;
+        }
+        int pair[2];
+        didCreateSockets = (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+        if (didCreateSockets) {
+            parentSockets[i] = pair[0];
+            workerSockets[i] = pair[1];
+            allSockets.insert(allSockets.end(), pair, pair + 2);
+        }
+    }
+    if (!didCreateSockets) {
+        perror("socketpair");
+    }
+
+    // Otherwise anything still buffered would be written out once by every worker too
+    std::cout.flush();
+    fflush(stdout);
+
+    std::vector<pid_t> workers;
+    for (int i = 0; i < numWorkers && didCreateSockets; ++i) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            break;
+        }
+        if (pid == 0) {
+            // Each worker has to hold only its own ends, or nobody would see the connection drop if a worker died
+            for (int socket : allSockets) {
+                bool isOwnSocket = (socket == workerSockets[i]);
+                for (int j = 0; j < numWorkers; ++j) {
+                    isOwnSocket = isOwnSocket || (socket == peerSockets[i][j]);
+                }
+                if (!isOwnSocket) {
+                    close(socket);
+                }
+            }
+            signal(SIGPIPE, SIG_IGN);
+            runWorker(i, numWorkers, numSamples, renderPart, peerSockets[i], workerSockets[i]);
+        }
+        workers.push_back(pid);
+    }
+
+    for (int socket : allSockets) {
+        bool isParentSocket = false;
+        for (int parentSocket : parentSockets) {
+            isParentSocket = isParentSocket || (socket == parentSocket);
+        }
+        if (!isParentSocket) {
+            close(socket);
+        }
+    }
+
+    bool didSucceed = didCreateSockets && (static_cast<int>(workers.size()) == numWorkers);
+    outComposite.depths.resize(numSamples);
+    outComposite.colors.resize(numSamples);
+    for (int i = 0; i < numWorkers && didSucceed; ++i) {
+        didSucceed = receiveSamples(parentSockets[i], outComposite,
+                                    getStripStart(numSamples, i, numWorkers), getStripStart(numSamples, i + 1, numWorkers));
+    }
+    for (int parentSocket : parentSockets) {
+        if (parentSocket >= 0) {
+            close(parentSocket);
+        }
+    }
+
+    for (pid_t worker : workers) {
+        int status = 0;
+        while (waitpid(worker, &status, 0) < 0 && errno == EINTR) {
+        }
+        didSucceed = didSucceed && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    return didSucceed;
+}
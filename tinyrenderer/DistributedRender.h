@@ -0,0 +1,41 @@
+//
+//  DistributedRender.h
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/19/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#ifndef DistributedRender_hpp
+#define DistributedRender_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Colour and depth for every sample of a frame (pixels, or pixels x samples with MSAA), in the same order as the
+// render targets they came from. Colours are TGAColor::val.
+struct DepthLayer {
+    std::vector<float> depths;
+    std::vector<uint32_t> colors;
+};
+
+// Draws one worker's share of the scene into a layer of the expected number of samples. Returns false on failure.
+typedef std::function<bool(int workerIndex, int numWorkers, DepthLayer &outLayer)> RenderPartFunction;
+
+// Sort-last rendering: runs renderPart in numWorkers worker processes, each drawing a different subset of the
+// geometry into its own colour and depth buffers, then merges their layers by depth.
+//
+// Compositing is direct-send, so it works for any number of workers (binary-swap needs a power of two). Every
+// worker owns one horizontal strip of the frame; the workers swap strips with each other over sockets, keep the
+// closest sample at each position, and send their finished strip back. Where depths are equal the
+// higher-numbered worker wins, so if workers are handed faces in draw order, the result matches a single render
+// with DepthTest::Equal shading. (With MSAA a few edge pixels can still differ: a triangle shades its pixel once,
+// at a sample it won, and which samples it wins in a worker depends on only that worker's faces.)
+//
+// Workers are forked from this process and talk over socketpairs. Nothing in the exchange depends on that besides
+// the byte order, so the same streams could run between machines.
+bool renderDistributed(int numWorkers, size_t numSamples, const RenderPartFunction &renderPart, DepthLayer &outComposite);
+
+#endif /* DistributedRender_hpp */
@@ -0,0 +1,79 @@
+//
+//  FrameArena.cpp
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/16/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#include "FrameArena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+const size_t FrameArena::DefaultBlockSize;
+
+FrameArena::FrameArena(size_t blockSize)
+: m_blockSize(blockSize)
+{
+}
+
+FrameArena &FrameArena::forCurrentThread() {
+    thread_local FrameArena arena;
+    return arena;
+}
+
+void* FrameArena::allocate(size_t numBytes, size_t alignment) {
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+    // Blocks after the current one are all free, but may be too small for this; skipping one wastes it until
+    // the next reset()
+    for (; m_currentBlock < m_blocks.size(); ++m_currentBlock, m_currentOffset = 0) {
+        Block &block = m_blocks[m_currentBlock];
+        const uintptr_t base = reinterpret_cast<uintptr_t>(block.memory.get());
+        const uintptr_t aligned = (base + m_currentOffset + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        const size_t alignedOffset = aligned - base;
+        if (alignedOffset + numBytes <= block.size) {
+            m_currentOffset = alignedOffset + numBytes;
+            return block.memory.get() + alignedOffset;
+        }
+    }
+
+    Block block;
+    block.size = std::max(m_blockSize, numBytes + alignment);
+    block.memory.reset(new unsigned char[block.size]);
+    m_blocks.push_back(std::move(block));
+    m_currentBlock = m_blocks.size() - 1;
+    m_currentOffset = 0;
+    return allocate(numBytes, alignment);
+}
+
+void FrameArena::rewind(const Marker &marker) {
+    assert(marker.blockIndex < m_currentBlock || (marker.blockIndex == m_currentBlock && marker.offset <= m_currentOffset));
+    m_currentBlock = marker.blockIndex;
+    m_currentOffset = marker.offset;
+}
+
+void FrameArena::trim(size_t maxBytesKept) {
+    assert(m_currentBlock == 0 && m_currentOffset == 0);
+
+    // Everything is free, so the blocks that fit can be kept whatever order they're in
+    std::vector<Block> keptBlocks;
+    size_t bytesKept = 0;
+    for (Block &block : m_blocks) {
+        if (bytesKept + block.size <= maxBytesKept) {
+            bytesKept += block.size;
+            keptBlocks.push_back(std::move(block));
+        }
+    }
+    m_blocks = std::move(keptBlocks);
+}
+
+size_t FrameArena::bytesReserved() const {
+    size_t total = 0;
+    for (const Block &block : m_blocks) {
+        total += block.size;
+    }
+    return total;
+}
@@ -0,0 +1,133 @@
+//
+//  FrameArena.h
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/16/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#ifndef FrameArena_hpp
+#define FrameArena_hpp
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Bump allocator for data that only lives for one frame (visible face lists, traversal stacks, scratch rows).
+// Allocating is a pointer bump, freeing individual allocations does nothing, and reset() hands everything back
+// at once at the end of the frame. The blocks are kept, so after the first few frames nothing touches malloc.
+//
+// Not thread-safe: each thread uses its own, from forCurrentThread().
+class FrameArena {
+public:
+    static const size_t DefaultBlockSize = 256 * 1024;
+
+    explicit FrameArena(size_t blockSize = DefaultBlockSize);
+
+    FrameArena(const FrameArena &) = delete;
+    FrameArena &operator=(const FrameArena &) = delete;
+
+    // The calling thread's arena
+    static FrameArena &forCurrentThread();
+
+    void* allocate(size_t numBytes, size_t alignment = alignof(std::max_align_t));
+
+    template<typename T>
+    T* allocateArray(size_t count) {
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    // A position in the arena to rewind() back to, freeing everything allocated since
+    struct Marker {
+        size_t blockIndex;
+        size_t offset;
+    };
+
+    Marker mark() const { return { m_currentBlock, m_currentOffset }; }
+    void rewind(const Marker &marker);
+
+    // Frees everything. Nothing allocated from the arena may still be in use.
+    void reset() { rewind({ 0, 0 }); }
+
+    // Frees blocks until no more than maxBytesKept are reserved, for after a frame that needed far more than
+    // usual. Only call it on a reset() arena.
+    void trim(size_t maxBytesKept);
+
+    size_t bytesReserved() const;
+
+    // Rewinds the arena when it goes out of scope, for scratch memory inside a single function
+    class Scope {
+    public:
+        explicit Scope(FrameArena &arena)
+        : m_arena(arena)
+        , m_marker(arena.mark())
+        {
+        }
+        ~Scope() { m_arena.rewind(m_marker); }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        FrameArena &m_arena;
+        Marker m_marker;
+    };
+
+private:
+    struct Block {
+        std::unique_ptr<unsigned char[]> memory;
+        size_t size;
+    };
+
+    const size_t m_blockSize;
+    std::vector<Block> m_blocks;
+    size_t m_currentBlock = 0;
+    size_t m_currentOffset = 0;
+};
+
+// Lets standard containers allocate from a FrameArena. By default they use the arena of the thread that
+// creates them, so a container must stay on that thread and mustn't outlive the frame.
+template<typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    ArenaAllocator()
+    : m_arena(&FrameArena::forCurrentThread())
+    {
+    }
+
+    explicit ArenaAllocator(FrameArena &arena)
+    : m_arena(&arena)
+    {
+    }
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other)
+    : m_arena(other.arena())
+    {
+    }
+
+    T* allocate(size_t count) { return m_arena->allocateArray<T>(count); }
+    void deallocate(T*, size_t) {}
+
+    FrameArena* arena() const { return m_arena; }
+
+private:
+    FrameArena* m_arena;
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+    return a.arena() == b.arena();
+}
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+    return a.arena() != b.arena();
+}
+
+template<typename T>
+using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif /* FrameArena_hpp */
@@ -0,0 +1,97 @@
+//
+//  FramePipeline.cpp
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/12/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#include "FramePipeline.h"
+
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// Encoded frames waiting on the disk. Each one holds a whole file in memory, so don't let them pile up.
+static const size_t MaxPendingWrites = 4;
+
+FramePipeline::FramePipeline(int width, int height, int bytesPerPixel, int numFramebuffers)
+: m_framebuffers(numFramebuffers, TGAImage(width, height, bytesPerPixel))
+, m_freeFramebuffers(numFramebuffers)
+, m_encodeJobs(numFramebuffers)
+, m_writeJobs(MaxPendingWrites)
+, m_didAllFramesSucceed(true)
+{
+    assert(numFramebuffers > 0);
+    for (int i = 0; i < numFramebuffers; ++i) {
+        m_freeFramebuffers.push(i);
+    }
+
+    m_encodeThread = std::thread(&FramePipeline::encodeLoop, this);
+    m_writeThread = std::thread(&FramePipeline::writeLoop, this);
+}
+
+FramePipeline::~FramePipeline() {
+    finish();
+}
+
+TGAImage &FramePipeline::beginFrame() {
+    assert(m_currentFramebuffer < 0 && !m_isFinished);
+    m_freeFramebuffers.pop(m_currentFramebuffer);
+
+    TGAImage &framebuffer = m_framebuffers[m_currentFramebuffer];
+    framebuffer.clear();
+    return framebuffer;
+}
+
+void FramePipeline::submitFrame(const std::string &filePath) {
+    assert(m_currentFramebuffer >= 0);
+    m_encodeJobs.push({ m_currentFramebuffer, filePath });
+    m_currentFramebuffer = -1;
+}
+
+bool FramePipeline::finish() {
+    if (!m_isFinished) {
+        m_isFinished = true;
+        // Closing lets each stage drain whatever is already queued and then exit, which in turn closes the next one
+        m_encodeJobs.close();
+        m_encodeThread.join();
+        m_writeThread.join();
+    }
+    return m_didAllFramesSucceed;
+}
+
+void FramePipeline::encodeLoop() {
+    EncodeJob job;
+    while (m_encodeJobs.pop(job)) {
+        TGAImage &framebuffer = m_framebuffers[job.framebufferIndex];
+        framebuffer.flip_vertically(); // i want to have the origin at the left bottom corner of the image
+
+        std::ostringstream encodedStream;
+        bool didEncode = framebuffer.write_tga(encodedStream);
+
+        // The pixels are all in encodedStream now, so the renderer can have the framebuffer back straight away
+        m_freeFramebuffers.push(job.framebufferIndex);
+
+        if (!didEncode) {
+            std::cerr << "Failed to encode frame: " << job.filePath << std::endl;
+            m_didAllFramesSucceed = false;
+            continue;
+        }
+        m_writeJobs.push({ job.filePath, encodedStream.str() });
+    }
+    m_writeJobs.close();
+}
+
+void FramePipeline::writeLoop() {
+    WriteJob job;
+    while (m_writeJobs.pop(job)) {
+        std::ofstream outputStream(job.filePath, std::ios::binary);
+        outputStream.write(job.encodedData.data(), job.encodedData.size());
+        if (!outputStream.good()) {
+            std::cerr << "Failed to write frame: " << job.filePath << std::endl;
+            m_didAllFramesSucceed = false;
+        }
+    }
+}
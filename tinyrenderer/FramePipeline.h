@@ -0,0 +1,67 @@
+//
+//  FramePipeline.h
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/12/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#ifndef FramePipeline_hpp
+#define FramePipeline_hpp
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BlockingQueue.hpp"
+#include "tgaimage.h"
+
+// Overlaps rendering a batch of frames with getting the previous ones onto disk. The caller rasterizes into
+// framebuffers from a small ring; each submitted frame is flipped and RLE-encoded on an encoder thread and then
+// written out on an I/O thread, so a batch runs at the speed of its slowest stage instead of the sum of all three.
+class FramePipeline {
+public:
+    FramePipeline(int width, int height, int bytesPerPixel, int numFramebuffers = 3);
+    ~FramePipeline();
+
+    FramePipeline(const FramePipeline &) = delete;
+    FramePipeline &operator=(const FramePipeline &) = delete;
+
+    // Waits until one of the ring's framebuffers is free again, clears it, and returns it to draw into.
+    // The image belongs to the caller until the matching submitFrame().
+    TGAImage &beginFrame();
+
+    // Hands the frame from beginFrame() over to be flipped (so the origin ends up bottom-left), encoded and written
+    void submitFrame(const std::string &filePath);
+
+    // Waits for every submitted frame to be written. Returns false if any of them couldn't be.
+    bool finish();
+
+private:
+    struct EncodeJob {
+        int framebufferIndex;
+        std::string filePath;
+    };
+
+    struct WriteJob {
+        std::string filePath;
+        std::string encodedData;
+    };
+
+    void encodeLoop();
+    void writeLoop();
+
+    std::vector<TGAImage> m_framebuffers;
+    BlockingQueue<int> m_freeFramebuffers;
+    BlockingQueue<EncodeJob> m_encodeJobs;
+    BlockingQueue<WriteJob> m_writeJobs;
+    int m_currentFramebuffer = -1;
+    bool m_isFinished = false;
+    std::atomic<bool> m_didAllFramesSucceed;
+
+    std::thread m_encodeThread;
+    std::thread m_writeThread;
+};
+
+#endif /* FramePipeline_hpp */
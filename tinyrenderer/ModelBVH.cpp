@@ -0,0 +1,505 @@
+//
+//  ModelBVH.cpp
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/9/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#include "ModelBVH.h"
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <memory>
+#include <queue>
+#include <thread>
+
+#include "CompactModel.h"
+
+static const int NumSAHBins = 16;
+static const int MaxFacesPerLeaf = 4;
+// Subtrees with at least this many faces get built on their own thread
+static const int ParallelBuildThreshold = 8192;
+
+struct BVHBuildNode {
+    BoundingBox bounds;
+    int firstFace;
+    int numFaces;
+    std::unique_ptr<BVHBuildNode> left;
+    std::unique_ptr<BVHBuildNode> right;
+};
+
+struct BVHBuildInput {
+    std::vector<BoundingBox> faceBounds;
+    std::vector<Vector3f> faceCentroids;
+};
+
+// parallelLevels is how many more levels of the tree may still hand their left subtree to a new thread
+static std::unique_ptr<BVHBuildNode> buildSubtree(const BVHBuildInput &input, std::vector<int> &faceIndices, int firstFace, int numFaces, int parallelLevels) {
+    std::unique_ptr<BVHBuildNode> node(new BVHBuildNode());
+    node->firstFace = firstFace;
+    node->numFaces = numFaces;
+
+    BoundingBox centroidBounds;
+    for (int i = firstFace; i < firstFace + numFaces; ++i) {
+        node->bounds.grow(input.faceBounds[faceIndices[i]]);
+        centroidBounds.grow(input.faceCentroids[faceIndices[i]]);
+    }
+
+    if (numFaces <= 1) {
+        return node;
+    }
+
+    // Bin the face centroids along the longest axis and evaluate the surface area heuristic at each bin boundary
+    const int axis = centroidBounds.longestAxis();
+    const float axisMin = centroidBounds.min[axis];
+    const float axisExtent = centroidBounds.max[axis] - axisMin;
+    int numLeftFaces = -1;
+    if (axisExtent > 0) {
+        auto getBin = [&](int faceIndex) {
+            int bin = static_cast<int>(NumSAHBins * (input.faceCentroids[faceIndex][axis] - axisMin) / axisExtent);
+            return std::min(bin, NumSAHBins - 1);
+        };
+
+        BoundingBox binBounds[NumSAHBins];
+        int binCounts[NumSAHBins] = {};
+        for (int i = firstFace; i < firstFace + numFaces; ++i) {
+            int bin = getBin(faceIndices[i]);
+            binBounds[bin].grow(input.faceBounds[faceIndices[i]]);
+            binCounts[bin]++;
+        }
+
+        // rightAreaTimesCount[i] is the cost of everything in bins (i, NumSAHBins)
+        float rightAreaTimesCount[NumSAHBins] = {};
+        BoundingBox rightBounds;
+        int rightCount = 0;
+        for (int bin = NumSAHBins - 1; bin > 0; --bin) {
+            rightBounds.grow(binBounds[bin]);
+            rightCount += binCounts[bin];
+            rightAreaTimesCount[bin - 1] = rightBounds.surfaceArea() * rightCount;
+        }
+
+        float bestCost = std::numeric_limits<float>::max();
+        int splitBin = -1;
+        BoundingBox leftBounds;
+        int leftCount = 0;
+        for (int bin = 0; bin < NumSAHBins - 1; ++bin) {
+            leftBounds.grow(binBounds[bin]);
+            leftCount += binCounts[bin];
+            if (leftCount == 0 || leftCount == numFaces) {
+                continue;
+            }
+            float cost = leftBounds.surfaceArea() * leftCount + rightAreaTimesCount[bin];
+            if (cost < bestCost) {
+                bestCost = cost;
+                splitBin = bin;
+            }
+        }
+
+        // Relative to a traversal step costing as much as one triangle test
+        const float leafCost = node->bounds.surfaceArea() * numFaces;
+        const float splitCost = node->bounds.surfaceArea() + bestCost;
+        if (numFaces <= MaxFacesPerLeaf && leafCost <= splitCost) {
+            return node;
+        }
+
+        if (splitBin >= 0) {
+            std::vector<int>::iterator first = faceIndices.begin() + firstFace;
+            std::vector<int>::iterator middle = std::partition(first, first + numFaces, [&](int faceIndex) {
+                return getBin(faceIndex) <= splitBin;
+            });
+            numLeftFaces = static_cast<int>(middle - first);
+        }
+    } else if (numFaces <= MaxFacesPerLeaf) {
+        return node;
+    }
+
+    if (numLeftFaces <= 0 || numLeftFaces >= numFaces) {
+        // All centroids fall in one bin (or on one point); fall back to a median split so we still make progress
+        numLeftFaces = numFaces / 2;
+        std::vector<int>::iterator first = faceIndices.begin() + firstFace;
+        std::nth_element(first, first + numLeftFaces, first + numFaces, [&](int lhs, int rhs) {
+            return input.faceCentroids[lhs][axis] < input.faceCentroids[rhs][axis];
+        });
+    }
+
+    // Both halves touch disjoint ranges of faceIndices, so they can be built concurrently
+    if (numFaces >= ParallelBuildThreshold && parallelLevels > 0) {
+        std::future<std::unique_ptr<BVHBuildNode>> leftFuture = std::async(std::launch::async, [&]() {
+            return buildSubtree(input, faceIndices, firstFace, numLeftFaces, parallelLevels - 1);
+        });
+        node->right = buildSubtree(input, faceIndices, firstFace + numLeftFaces, numFaces - numLeftFaces, parallelLevels - 1);
+        node->left = leftFuture.get();
+    } else {
+        node->left = buildSubtree(input, faceIndices, firstFace, numLeftFaces, parallelLevels - 1);
+        node->right = buildSubtree(input, faceIndices, firstFace + numLeftFaces, numFaces - numLeftFaces, parallelLevels - 1);
+    }
+    return node;
+}
+
+template<typename NodeVector>
+static void flattenSubtree(const BVHBuildNode &buildNode, NodeVector &nodes) {
+    const size_t nodeIndex = nodes.size();
+    nodes.push_back({ buildNode.bounds, buildNode.firstFace, buildNode.numFaces, -1 });
+    if (buildNode.left) {
+        flattenSubtree(*buildNode.left, nodes);
+        nodes[nodeIndex].rightChild = static_cast<int>(nodes.size());
+        flattenSubtree(*buildNode.right, nodes);
+    }
+}
+
+template<typename Model>
+static void getModelFaceTriangle(const Model &model, int faceIndex, Vector3f outPoints[3]) {
+    ModelFace face = model.faceAtIndex(faceIndex);
+    for (int i = 0; i < 3; ++i) {
+        outPoints[i] = model.vertexAtIndex(face.vertices[i].positionIndex);
+    }
+}
+
+void ModelBVH::getFaceTriangle(int faceIndex, Vector3f outPoints[3]) const {
+    if (m_compactModel) {
+        getModelFaceTriangle(*m_compactModel, faceIndex, outPoints);
+    } else {
+        getModelFaceTriangle(*m_model, faceIndex, outPoints);
+    }
+}
+
+void ModelBVH::build(const ObjModel &model) {
+    m_model = &model;
+    m_compactModel = nullptr;
+    buildNodes(static_cast<int>(model.numFaces()));
+}
+
+void ModelBVH::build(const CompactModel &model) {
+    m_model = nullptr;
+    m_compactModel = &model;
+    buildNodes(static_cast<int>(model.numFaces()));
+}
+
+void ModelBVH::buildNodes(int numFaces) {
+    m_nodes.clear();
+    m_faceIndices.clear();
+
+    if (numFaces == 0) {
+        return;
+    }
+
+    // Per-face bounds and centroids, split across the available cores
+    BVHBuildInput input;
+    input.faceBounds.resize(numFaces);
+    input.faceCentroids.resize(numFaces);
+    const int numThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    const int numFaceRanges = std::min(numThreads, numFaces / ParallelBuildThreshold + 1);
+    std::vector<std::thread> threads;
+    for (int rangeIndex = 0; rangeIndex < numFaceRanges; ++rangeIndex) {
+        const int rangeBegin = static_cast<int>(static_cast<long long>(numFaces) * rangeIndex / numFaceRanges);
+        const int rangeEnd = static_cast<int>(static_cast<long long>(numFaces) * (rangeIndex + 1) / numFaceRanges);
+        threads.emplace_back([this, &input, rangeBegin, rangeEnd]() {
+            for (int faceIndex = rangeBegin; faceIndex < rangeEnd; ++faceIndex) {
+                Vector3f points[3];
+                getFaceTriangle(faceIndex, points);
+                BoundingBox faceBounds;
+                for (int i = 0; i < 3; ++i) {
+                    faceBounds.grow(points[i]);
+                }
+                input.faceBounds[faceIndex] = faceBounds;
+                input.faceCentroids[faceIndex] = faceBounds.center();
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    m_faceIndices.resize(numFaces);
+    for (int faceIndex = 0; faceIndex < numFaces; ++faceIndex) {
+        m_faceIndices[faceIndex] = faceIndex;
+    }
+
+    // Enough levels to give every core a subtree of its own, plus one so that uneven splits still keep them busy
+    int parallelLevels = 1;
+    while ((1 << (parallelLevels - 1)) < numThreads) {
+        ++parallelLevels;
+    }
+    std::unique_ptr<BVHBuildNode> root = buildSubtree(input, m_faceIndices, 0, numFaces, parallelLevels);
+    m_nodes.reserve(2 * numFaces);
+    flattenSubtree(*root, m_nodes);
+}
+
+void ModelBVH::getFacesInsidePlanes(const std::vector<Plane> &planes, FrameVector<int> &outFaceIndices) const {
+    if (m_nodes.empty()) {
+        return;
+    }
+
+    // Nodes whose faces are all accepted. Their ranges of m_faceIndices are in the BVH's partition order, not the
+    // model's, so they're only turned back into face indices at the end.
+    FrameVector<int> acceptedNodes;
+    size_t numAcceptedFaces = 0;
+
+    FrameVector<int> nodeStack;
+    nodeStack.push_back(0);
+    while (!nodeStack.empty()) {
+        const Node &node = m_nodes[nodeStack.back()];
+        const int nodeIndex = nodeStack.back();
+        nodeStack.pop_back();
+
+        bool isFullyInside = true;
+        bool isFullyOutside = false;
+        for (const Plane &plane : planes) {
+            // The box corners furthest along and furthest against the plane normal
+            Vector3f furthestInside;
+            Vector3f furthestOutside;
+            for (int axis = 0; axis < 3; ++axis) {
+                bool isPositive = plane.normal[axis] >= 0;
+                furthestInside[axis] = isPositive ? node.bounds.max[axis] : node.bounds.min[axis];
+                furthestOutside[axis] = isPositive ? node.bounds.min[axis] : node.bounds.max[axis];
+            }
+            if (plane.normal.dot(furthestInside) + plane.distance < 0) {
+                isFullyOutside = true;
+                break;
+            }
+            if (plane.normal.dot(furthestOutside) + plane.distance < 0) {
+                isFullyInside = false;
+            }
+        }
+
+        if (isFullyOutside) {
+            continue;
+        }
+        if (isFullyInside || node.rightChild < 0) {
+            acceptedNodes.push_back(nodeIndex);
+            numAcceptedFaces += node.numFaces;
+            continue;
+        }
+
+        nodeStack.push_back(node.rightChild);
+        nodeStack.push_back(nodeIndex + 1);
+    }
+
+    // Callers draw faces in the order they come out, and the model's own order is the one optimizeLayout() tuned
+    // for the vertex cache, so hand them back in that order: mark every accepted face, then walk the marks
+    const int numFaces = static_cast<int>(m_faceIndices.size());
+    if (numAcceptedFaces == m_faceIndices.size()) {
+        for (int faceIndex = 0; faceIndex < numFaces; ++faceIndex) {
+            outFaceIndices.push_back(faceIndex);
+        }
+        return;
+    }
+    FrameVector<unsigned char> isFaceAccepted(numFaces, 0);
+    for (int nodeIndex : acceptedNodes) {
+        const Node &node = m_nodes[nodeIndex];
+        for (int i = node.firstFace; i < node.firstFace + node.numFaces; ++i) {
+            isFaceAccepted[m_faceIndices[i]] = 1;
+        }
+    }
+    outFaceIndices.reserve(outFaceIndices.size() + numAcceptedFaces);
+    for (int faceIndex = 0; faceIndex < numFaces; ++faceIndex) {
+        if (isFaceAccepted[faceIndex]) {
+            outFaceIndices.push_back(faceIndex);
+        }
+    }
+}
+
+// Returns the distance along the ray at which it enters the box, or a negative value if it misses it
+static float rayBoxEntryDistance(const BoundingBox &box, const Vector3f &origin, const Vector3f &inverseDirection, float maxDistance) {
+    float tMin = 0.f;
+    float tMax = maxDistance;
+    for (int axis = 0; axis < 3; ++axis) {
+        float t0 = (box.min[axis] - origin[axis]) * inverseDirection[axis];
+        float t1 = (box.max[axis] - origin[axis]) * inverseDirection[axis];
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+        tMin = std::max(tMin, t0);
+        tMax = std::min(tMax, t1);
+        if (tMin > tMax) {
+            return -1.f;
+        }
+    }
+    return tMin;
+}
+
+// Möller-Trumbore. On a hit returns true and fills in the distance along the ray and barycentric coords (u for points[0])
+static bool rayTriangleIntersection(const Vector3f points[3], const Vector3f &origin, const Vector3f &direction, float &outDistance, Vector3f &outBarycentricCoords) {
+    Vector3f edge1 = points[1] - points[0];
+    Vector3f edge2 = points[2] - points[0];
+    Vector3f p = direction.cross(edge2);
+    float determinant = edge1.dot(p);
+    if (std::abs(determinant) < std::numeric_limits<float>::epsilon()) {
+        return false;
+    }
+
+    float inverseDeterminant = 1.f / determinant;
+    Vector3f toOrigin = origin - points[0];
+    float v = toOrigin.dot(p) * inverseDeterminant;
+    if (v < 0.f || v > 1.f) {
+        return false;
+    }
+    Vector3f q = toOrigin.cross(edge1);
+    float w = direction.dot(q) * inverseDeterminant;
+    if (w < 0.f || v + w > 1.f) {
+        return false;
+    }
+    float distance = edge2.dot(q) * inverseDeterminant;
+    if (distance < 0.f) {
+        return false;
+    }
+
+    outDistance = distance;
+    outBarycentricCoords = Vector3f(1.f - v - w, v, w);
+    return true;
+}
+
+bool ModelBVH::raycast(const Vector3f &origin, const Vector3f &direction, RayHit &outHit) const {
+    if (m_nodes.empty()) {
+        return false;
+    }
+
+    Vector3f inverseDirection;
+    for (int axis = 0; axis < 3; ++axis) {
+        // Division by zero gives +/-inf, which the slab test handles correctly
+        inverseDirection[axis] = 1.f / direction[axis];
+    }
+
+    float closestDistance = std::numeric_limits<float>::max();
+    bool didHit = false;
+    std::vector<int> nodeStack;
+    nodeStack.push_back(0);
+    while (!nodeStack.empty()) {
+        const int nodeIndex = nodeStack.back();
+        const Node &node = m_nodes[nodeIndex];
+        nodeStack.pop_back();
+
+        if (rayBoxEntryDistance(node.bounds, origin, inverseDirection, closestDistance) < 0) {
+            continue;
+        }
+
+        if (node.rightChild < 0) {
+            for (int i = node.firstFace; i < node.firstFace + node.numFaces; ++i) {
+                Vector3f points[3];
+                getFaceTriangle(m_faceIndices[i], points);
+                float distance;
+                Vector3f barycentricCoords;
+                if (rayTriangleIntersection(points, origin, direction, distance, barycentricCoords) && distance < closestDistance) {
+                    closestDistance = distance;
+                    outHit.faceIndex = m_faceIndices[i];
+                    outHit.distance = distance;
+                    outHit.barycentricCoords = barycentricCoords;
+                    didHit = true;
+                }
+            }
+            continue;
+        }
+
+        // Visit the nearer child first so closestDistance shrinks quickly and prunes the other one
+        int nearChild = nodeIndex + 1;
+        int farChild = node.rightChild;
+        float nearDistance = rayBoxEntryDistance(m_nodes[nearChild].bounds, origin, inverseDirection, closestDistance);
+        float farDistance = rayBoxEntryDistance(m_nodes[farChild].bounds, origin, inverseDirection, closestDistance);
+        if (farDistance >= 0 && (nearDistance < 0 || farDistance < nearDistance)) {
+            std::swap(nearChild, farChild);
+        }
+        nodeStack.push_back(farChild);
+        nodeStack.push_back(nearChild);
+    }
+
+    return didHit;
+}
+
+static float squaredDistanceToBox(const BoundingBox &box, const Vector3f &point) {
+    float squaredDistance = 0.f;
+    for (int axis = 0; axis < 3; ++axis) {
+        float delta = std::max(std::max(box.min[axis] - point[axis], 0.f), point[axis] - box.max[axis]);
+        squaredDistance += delta * delta;
+    }
+    return squaredDistance;
+}
+
+// From Ericson, "Real-Time Collision Detection", 5.1.5
+static Vector3f closestPointOnTriangle(const Vector3f &point, const Vector3f &a, const Vector3f &b, const Vector3f &c) {
+    Vector3f ab = b - a;
+    Vector3f ac = c - a;
+    Vector3f ap = point - a;
+    float d1 = ab.dot(ap);
+    float d2 = ac.dot(ap);
+    if (d1 <= 0.f && d2 <= 0.f) return a;
+
+    Vector3f bp = point - b;
+    float d3 = ab.dot(bp);
+    float d4 = ac.dot(bp);
+    if (d3 >= 0.f && d4 <= d3) return b;
+
+    float vc = d1*d4 - d3*d2;
+    if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f) {
+        return a + ab * (d1 / (d1 - d3));
+    }
+
+    Vector3f cp = point - c;
+    float d5 = ab.dot(cp);
+    float d6 = ac.dot(cp);
+    if (d6 >= 0.f && d5 <= d6) return c;
+
+    float vb = d5*d2 - d1*d6;
+    if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f) {
+        return a + ac * (d2 / (d2 - d6));
+    }
+
+    float va = d3*d6 - d5*d4;
+    if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f) {
+        return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    }
+
+    float denominator = 1.f / (va + vb + vc);
+    float v = vb * denominator;
+    float w = vc * denominator;
+    return a + ab * v + ac * w;
+}
+
+int ModelBVH::nearestFace(const Vector3f &point, float &outDistance) const {
+    if (m_nodes.empty()) {
+        return -1;
+    }
+
+    // Best-first search: always expand the node whose box is closest, and stop once no box can beat the best face
+    typedef std::pair<float, int> QueueEntry; // (squared distance to box, node index)
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry>> nodeQueue;
+    nodeQueue.push(QueueEntry(squaredDistanceToBox(m_nodes[0].bounds, point), 0));
+
+    float closestSquaredDistance = std::numeric_limits<float>::max();
+    int closestFace = -1;
+    while (!nodeQueue.empty()) {
+        QueueEntry entry = nodeQueue.top();
+        nodeQueue.pop();
+        if (entry.first >= closestSquaredDistance) {
+            break;
+        }
+
+        const int nodeIndex = entry.second;
+        const Node &node = m_nodes[nodeIndex];
+        if (node.rightChild < 0) {
+            for (int i = node.firstFace; i < node.firstFace + node.numFaces; ++i) {
+                Vector3f points[3];
+                getFaceTriangle(m_faceIndices[i], points);
+                Vector3f offset = closestPointOnTriangle(point, points[0], points[1], points[2]) - point;
+                float squaredDistance = offset.dot(offset);
+                if (squaredDistance < closestSquaredDistance) {
+                    closestSquaredDistance = squaredDistance;
+                    closestFace = m_faceIndices[i];
+                }
+            }
+            continue;
+        }
+
+        const int children[2] = { nodeIndex + 1, node.rightChild };
+        for (int child : children) {
+            float squaredDistance = squaredDistanceToBox(m_nodes[child].bounds, point);
+            if (squaredDistance < closestSquaredDistance) {
+                nodeQueue.push(QueueEntry(squaredDistance, child));
+            }
+        }
+    }
+
+    outDistance = std::sqrt(closestSquaredDistance);
+    return closestFace;
+}
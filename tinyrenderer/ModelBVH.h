@@ -0,0 +1,77 @@
+//
+//  ModelBVH.h
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/9/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#ifndef ModelBVH_hpp
+#define ModelBVH_hpp
+
+#include <vector>
+
+#include "BoundingBox.hpp"
+#include "FrameArena.h"
+#include "ObjModel.h"
+#include "Vector.hpp"
+
+// Points p with normal.dot(p) + distance >= 0 are on the inside of the plane
+struct Plane {
+    Vector3f normal;
+    float distance;
+};
+
+struct RayHit {
+    int faceIndex;
+    float distance;
+    Vector3f barycentricCoords;
+};
+
+class CompactModel;
+
+// Bounding volume hierarchy over the faces of an ObjModel (or CompactModel), built top-down with binned SAH.
+// The BVH only stores face indices, so the model must outlive it and must not be modified after build().
+class ModelBVH {
+public:
+    ModelBVH() = default;
+
+    // Large subtrees are built on separate threads
+    void build(const ObjModel &model);
+    void build(const CompactModel &model);
+
+    // Appends the index of every face whose bounding box isn't entirely outside one of the planes, in ascending
+    // order (i.e. the model's draw order). Whole subtrees are skipped (or accepted) with a single box test. This
+    // runs every frame, so the result and the traversal stack come from the calling thread's FrameArena.
+    void getFacesInsidePlanes(const std::vector<Plane> &planes, FrameVector<int> &outFaceIndices) const;
+
+    // Finds the closest face hit by the ray (direction need not be normalized; distance is in units of it)
+    bool raycast(const Vector3f &origin, const Vector3f &direction, RayHit &outHit) const;
+
+    // Returns the index of the face closest to point, or -1 if the model has no faces
+    int nearestFace(const Vector3f &point, float &outDistance) const;
+
+    size_t numNodes() const { return m_nodes.size(); }
+    BoundingBox bounds() const { return m_nodes.empty() ? BoundingBox() : m_nodes[0].bounds; }
+
+private:
+    // Nodes are stored depth-first, so an interior node's left child directly follows it.
+    // Every node covers the contiguous range [firstFace, firstFace + numFaces) of m_faceIndices.
+    struct Node {
+        BoundingBox bounds;
+        int firstFace;
+        int numFaces;
+        int rightChild; // -1 for leaves
+    };
+
+    void buildNodes(int numFaces);
+    void getFaceTriangle(int faceIndex, Vector3f outPoints[3]) const;
+
+    // Exactly one of these is set
+    const ObjModel* m_model = nullptr;
+    const CompactModel* m_compactModel = nullptr;
+    std::vector<Node> m_nodes;
+    std::vector<int> m_faceIndices;
+};
+
+#endif /* ModelBVH_hpp */
@@ -0,0 +1,475 @@
+//
+//  ModelLOD.cpp
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/10/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#include "ModelLOD.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iterator>
+#include <map>
+#include <queue>
+#include <utility>
+
+// How much more a boundary or UV seam edge resists moving than an interior one
+static const double ConstraintPlaneWeight = 1000.0;
+
+// Roughly how many pixels of screen area each face should get before a coarser level is good enough
+static const float TargetPixelsPerFace = 8.f;
+
+// Symmetric 4x4 matrix Q such that v^T Q v is the sum of squared distances from v to a set of planes
+struct Quadric {
+    double a2, ab, ac, ad;
+    double     b2, bc, bd;
+    double         c2, cd;
+    double             d2;
+
+    Quadric()
+    : a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0)
+    {
+    }
+
+    // The plane is ax + by + cz + d = 0 with (a,b,c) unit length
+    static Quadric fromPlane(double a, double b, double c, double d, double weight) {
+        Quadric q;
+        q.a2 = weight*a*a; q.ab = weight*a*b; q.ac = weight*a*c; q.ad = weight*a*d;
+        q.b2 = weight*b*b; q.bc = weight*b*c; q.bd = weight*b*d;
+        q.c2 = weight*c*c; q.cd = weight*c*d;
+        q.d2 = weight*d*d;
+        return q;
+    }
+
+    Quadric &operator+=(const Quadric &rhs) {
+        a2 += rhs.a2; ab += rhs.ab; ac += rhs.ac; ad += rhs.ad;
+        b2 += rhs.b2; bc += rhs.bc; bd += rhs.bd;
+        c2 += rhs.c2; cd += rhs.cd;
+        d2 += rhs.d2;
+        return *this;
+    }
+
+    double evaluate(const Vector3f &point) const {
+        double x = point.x, y = point.y, z = point.z;
+        return a2*x*x + 2*ab*x*y + 2*ac*x*z + 2*ad*x
+             + b2*y*y + 2*bc*y*z + 2*bd*y
+             + c2*z*z + 2*cd*z
+             + d2;
+    }
+};
+
+struct CollapseCandidate {
+    double cost;
+    int fromVertex;
+    int toVertex;
+    int fromVersion;
+    int toVersion;
+
+    bool operator>(const CollapseCandidate &rhs) const { return cost > rhs.cost; }
+};
+
+class QuadricSimplifier {
+public:
+    QuadricSimplifier(const ObjModel &model);
+    ObjModel simplify(size_t targetNumFaces);
+
+private:
+    void addConstraintQuadrics();
+    void pushCandidates(int vertexA, int vertexB);
+    bool getTexCoordRemapping(int fromVertex, int toVertex, std::map<int, int> &outRemapping) const;
+    bool isCollapseValid(int fromVertex, int toVertex) const;
+    void collapse(int fromVertex, int toVertex, const std::map<int, int> &texCoordRemapping);
+    void getNeighbours(int vertex, std::vector<int> &outNeighbours) const;
+    Vector3f getFaceNormal(const ModelFace &face) const;
+    ObjModel buildModel() const;
+
+    std::vector<Vector3f> m_vertices;
+    std::vector<Vector2f> m_textureCoordinates;
+    std::vector<ModelFace> m_faces;
+    std::vector<bool> m_isFaceAlive;
+    size_t m_numAliveFaces;
+
+    std::vector<std::vector<int>> m_vertexFaces;
+    std::vector<Quadric> m_quadrics;
+    std::vector<int> m_vertexVersions;
+    std::priority_queue<CollapseCandidate, std::vector<CollapseCandidate>, std::greater<CollapseCandidate>> m_candidates;
+};
+
+static bool faceContainsVertex(const ModelFace &face, int vertex) {
+    return face.vertices[0].positionIndex == vertex
+        || face.vertices[1].positionIndex == vertex
+        || face.vertices[2].positionIndex == vertex;
+}
+
+QuadricSimplifier::QuadricSimplifier(const ObjModel &model)
+: m_numAliveFaces(model.numFaces())
+{
+    m_vertices.reserve(model.numVertices());
+    for (size_t i = 0; i < model.numVertices(); ++i) {
+        m_vertices.push_back(model.vertexAtIndex(static_cast<int>(i)));
+    }
+    m_textureCoordinates.reserve(model.numTexCoords());
+    for (size_t i = 0; i < model.numTexCoords(); ++i) {
+        m_textureCoordinates.push_back(model.texCoordAtIndex(static_cast<int>(i)));
+    }
+    m_faces.reserve(model.numFaces());
+    for (size_t i = 0; i < model.numFaces(); ++i) {
+        m_faces.push_back(model.faceAtIndex(static_cast<int>(i)));
+    }
+    m_isFaceAlive.assign(m_faces.size(), true);
+
+    m_vertexFaces.resize(m_vertices.size());
+    m_quadrics.resize(m_vertices.size());
+    m_vertexVersions.assign(m_vertices.size(), 0);
+    for (size_t faceIndex = 0; faceIndex < m_faces.size(); ++faceIndex) {
+        const ModelFace &face = m_faces[faceIndex];
+        Vector3f edge1 = m_vertices[face.vertices[1].positionIndex] - m_vertices[face.vertices[0].positionIndex];
+        Vector3f edge2 = m_vertices[face.vertices[2].positionIndex] - m_vertices[face.vertices[0].positionIndex];
+        Vector3f crossProduct = edge1.cross(edge2);
+        float doubleArea = crossProduct.magnitude();
+
+        // Weighted by area so that lots of tiny faces don't outvote a few big ones
+        Quadric faceQuadric;
+        if (doubleArea > 0) {
+            Vector3f normal = crossProduct * (1.f / doubleArea);
+            double d = -normal.dot(m_vertices[face.vertices[0].positionIndex]);
+            faceQuadric = Quadric::fromPlane(normal.x, normal.y, normal.z, d, 0.5 * doubleArea);
+        }
+
+        for (int i = 0; i < 3; ++i) {
+            int vertex = face.vertices[i].positionIndex;
+            m_vertexFaces[vertex].push_back(static_cast<int>(faceIndex));
+            m_quadrics[vertex] += faceQuadric;
+        }
+    }
+
+    addConstraintQuadrics();
+}
+
+void QuadricSimplifier::addConstraintQuadrics() {
+    // Edges with only one face are mesh boundaries, and edges whose two faces disagree on the texture coordinates
+    // of its ends are UV seams. Both get a plane through the edge, perpendicular to the face, so that sliding an end
+    // off the edge line is expensive.
+    struct EdgeUse {
+        int faceIndex;
+        int texCoords[2]; // at the (smaller, larger) position index ends
+    };
+    std::map<std::pair<int, int>, std::vector<EdgeUse>> edgeUses;
+    for (size_t faceIndex = 0; faceIndex < m_faces.size(); ++faceIndex) {
+        const ModelFace &face = m_faces[faceIndex];
+        for (int i = 0; i < 3; ++i) {
+            const ModelVertex &a = face.vertices[i];
+            const ModelVertex &b = face.vertices[(i + 1) % 3];
+            EdgeUse use;
+            use.faceIndex = static_cast<int>(faceIndex);
+            bool isASmaller = a.positionIndex < b.positionIndex;
+            use.texCoords[0] = isASmaller ? a.texCoordIndex : b.texCoordIndex;
+            use.texCoords[1] = isASmaller ? b.texCoordIndex : a.texCoordIndex;
+            edgeUses[std::make_pair(std::min(a.positionIndex, b.positionIndex), std::max(a.positionIndex, b.positionIndex))].push_back(use);
+        }
+    }
+
+    for (const auto &entry : edgeUses) {
+        const std::vector<EdgeUse> &uses = entry.second;
+        bool isConstrained = (uses.size() == 1);
+        for (size_t i = 1; i < uses.size() && !isConstrained; ++i) {
+            isConstrained = uses[i].texCoords[0] != uses[0].texCoords[0] || uses[i].texCoords[1] != uses[0].texCoords[1];
+        }
+        if (!isConstrained) {
+            continue;
+        }
+
+        const int vertexA = entry.first.first;
+        const int vertexB = entry.first.second;
+        Vector3f edge = m_vertices[vertexB] - m_vertices[vertexA];
+        float edgeLength = edge.magnitude();
+        if (edgeLength <= 0) {
+            continue;
+        }
+        for (const EdgeUse &use : uses) {
+            Vector3f faceNormal = getFaceNormal(m_faces[use.faceIndex]);
+            Vector3f planeNormal = edge.cross(faceNormal);
+            float planeNormalLength = planeNormal.magnitude();
+            if (planeNormalLength <= 0) {
+                continue;
+            }
+            planeNormal = planeNormal * (1.f / planeNormalLength);
+            double d = -planeNormal.dot(m_vertices[vertexA]);
+            Quadric constraint = Quadric::fromPlane(planeNormal.x, planeNormal.y, planeNormal.z, d, ConstraintPlaneWeight * edgeLength * edgeLength);
+            m_quadrics[vertexA] += constraint;
+            m_quadrics[vertexB] += constraint;
+        }
+    }
+}
+
+Vector3f QuadricSimplifier::getFaceNormal(const ModelFace &face) const {
+    Vector3f edge1 = m_vertices[face.vertices[1].positionIndex] - m_vertices[face.vertices[0].positionIndex];
+    Vector3f edge2 = m_vertices[face.vertices[2].positionIndex] - m_vertices[face.vertices[0].positionIndex];
+    Vector3f crossProduct = edge1.cross(edge2);
+    float length = crossProduct.magnitude();
+    return (length > 0) ? crossProduct * (1.f / length) : Vector3f();
+}
+
+void QuadricSimplifier::getNeighbours(int vertex, std::vector<int> &outNeighbours) const {
+    outNeighbours.clear();
+    for (int faceIndex : m_vertexFaces[vertex]) {
+        if (!m_isFaceAlive[faceIndex]) {
+            continue;
+        }
+        for (int i = 0; i < 3; ++i) {
+            int neighbour = m_faces[faceIndex].vertices[i].positionIndex;
+            if (neighbour != vertex) {
+                outNeighbours.push_back(neighbour);
+            }
+        }
+    }
+    std::sort(outNeighbours.begin(), outNeighbours.end());
+    outNeighbours.erase(std::unique(outNeighbours.begin(), outNeighbours.end()), outNeighbours.end());
+}
+
+void QuadricSimplifier::pushCandidates(int vertexA, int vertexB) {
+    // Half-edge collapses in both directions; whichever is cheapest and still valid when popped wins
+    Quadric combined = m_quadrics[vertexA];
+    combined += m_quadrics[vertexB];
+
+    CollapseCandidate aToB = { combined.evaluate(m_vertices[vertexB]), vertexA, vertexB, m_vertexVersions[vertexA], m_vertexVersions[vertexB] };
+    CollapseCandidate bToA = { combined.evaluate(m_vertices[vertexA]), vertexB, vertexA, m_vertexVersions[vertexB], m_vertexVersions[vertexA] };
+    m_candidates.push(aToB);
+    m_candidates.push(bToA);
+}
+
+// Every corner of fromVertex will be moved onto toVertex, so it needs to know which of toVertex's texture
+// coordinates to switch to. The faces along the collapsing edge tell us; if they don't cover every texture
+// coordinate fromVertex uses (it's on a seam that doesn't run along this edge), or contradict each other,
+// the collapse would tear or smear the texture.
+bool QuadricSimplifier::getTexCoordRemapping(int fromVertex, int toVertex, std::map<int, int> &outRemapping) const {
+    outRemapping.clear();
+    for (int faceIndex : m_vertexFaces[fromVertex]) {
+        const ModelFace &face = m_faces[faceIndex];
+        if (!m_isFaceAlive[faceIndex] || !faceContainsVertex(face, toVertex)) {
+            continue;
+        }
+        int fromTexCoord = -1;
+        int toTexCoord = -1;
+        for (int i = 0; i < 3; ++i) {
+            if (face.vertices[i].positionIndex == fromVertex) fromTexCoord = face.vertices[i].texCoordIndex;
+            if (face.vertices[i].positionIndex == toVertex) toTexCoord = face.vertices[i].texCoordIndex;
+        }
+        std::map<int, int>::const_iterator existing = outRemapping.find(fromTexCoord);
+        if (existing != outRemapping.end() && existing->second != toTexCoord) {
+            return false;
+        }
+        outRemapping[fromTexCoord] = toTexCoord;
+    }
+
+    for (int faceIndex : m_vertexFaces[fromVertex]) {
+        if (!m_isFaceAlive[faceIndex]) {
+            continue;
+        }
+        for (int i = 0; i < 3; ++i) {
+            const ModelVertex &corner = m_faces[faceIndex].vertices[i];
+            if (corner.positionIndex == fromVertex && outRemapping.find(corner.texCoordIndex) == outRemapping.end()) {
+                return false;
+            }
+        }
+    }
+    return !outRemapping.empty();
+}
+
+bool QuadricSimplifier::isCollapseValid(int fromVertex, int toVertex) const {
+    // Link condition: the only vertices both ends share should be the far corners of the faces along the edge,
+    // otherwise the collapse pinches the surface into something non-manifold
+    std::vector<int> fromNeighbours;
+    std::vector<int> toNeighbours;
+    getNeighbours(fromVertex, fromNeighbours);
+    getNeighbours(toVertex, toNeighbours);
+    if (!std::binary_search(fromNeighbours.begin(), fromNeighbours.end(), toVertex)) {
+        return false;
+    }
+    std::vector<int> sharedNeighbours;
+    std::set_intersection(fromNeighbours.begin(), fromNeighbours.end(), toNeighbours.begin(), toNeighbours.end(), std::back_inserter(sharedNeighbours));
+    int numEdgeFaces = 0;
+    for (int faceIndex : m_vertexFaces[fromVertex]) {
+        if (m_isFaceAlive[faceIndex] && faceContainsVertex(m_faces[faceIndex], toVertex)) {
+            ++numEdgeFaces;
+        }
+    }
+    if (static_cast<int>(sharedNeighbours.size()) != numEdgeFaces) {
+        return false;
+    }
+
+    // Don't let any of the faces that survive flip over or collapse to a line
+    for (int faceIndex : m_vertexFaces[fromVertex]) {
+        const ModelFace &face = m_faces[faceIndex];
+        if (!m_isFaceAlive[faceIndex] || faceContainsVertex(face, toVertex)) {
+            continue;
+        }
+        ModelFace movedFace = face;
+        for (int i = 0; i < 3; ++i) {
+            if (movedFace.vertices[i].positionIndex == fromVertex) {
+                movedFace.vertices[i].positionIndex = toVertex;
+            }
+        }
+        Vector3f oldNormal = getFaceNormal(face);
+        Vector3f newNormal = getFaceNormal(movedFace);
+        if (newNormal.dot(oldNormal) <= 0.1f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void QuadricSimplifier::collapse(int fromVertex, int toVertex, const std::map<int, int> &texCoordRemapping) {
+    for (int faceIndex : m_vertexFaces[fromVertex]) {
+        if (!m_isFaceAlive[faceIndex]) {
+            continue;
+        }
+        ModelFace &face = m_faces[faceIndex];
+        if (faceContainsVertex(face, toVertex)) {
+            m_isFaceAlive[faceIndex] = false;
+            --m_numAliveFaces;
+            continue;
+        }
+        for (int i = 0; i < 3; ++i) {
+            ModelVertex &corner = face.vertices[i];
+            if (corner.positionIndex == fromVertex) {
+                corner.positionIndex = toVertex;
+                corner.texCoordIndex = texCoordRemapping.at(corner.texCoordIndex);
+            }
+        }
+        m_vertexFaces[toVertex].push_back(faceIndex);
+    }
+    m_vertexFaces[fromVertex].clear();
+
+    std::vector<int> &toFaces = m_vertexFaces[toVertex];
+    toFaces.erase(std::remove_if(toFaces.begin(), toFaces.end(), [this](int faceIndex) {
+        return !m_isFaceAlive[faceIndex];
+    }), toFaces.end());
+
+    m_quadrics[toVertex] += m_quadrics[fromVertex];
+    ++m_vertexVersions[fromVertex];
+    ++m_vertexVersions[toVertex];
+}
+
+ObjModel QuadricSimplifier::simplify(size_t targetNumFaces) {
+    std::vector<int> neighbours;
+    for (size_t vertex = 0; vertex < m_vertices.size(); ++vertex) {
+        getNeighbours(static_cast<int>(vertex), neighbours);
+        for (int neighbour : neighbours) {
+            if (neighbour > static_cast<int>(vertex)) {
+                pushCandidates(static_cast<int>(vertex), neighbour);
+            }
+        }
+    }
+
+    std::map<int, int> texCoordRemapping;
+    while (m_numAliveFaces > targetNumFaces && !m_candidates.empty()) {
+        CollapseCandidate candidate = m_candidates.top();
+        m_candidates.pop();
+
+        // Anything queued before either end last changed has a stale cost
+        if (candidate.fromVersion != m_vertexVersions[candidate.fromVertex] || candidate.toVersion != m_vertexVersions[candidate.toVertex]) {
+            continue;
+        }
+        if (!getTexCoordRemapping(candidate.fromVertex, candidate.toVertex, texCoordRemapping)) {
+            continue;
+        }
+        if (!isCollapseValid(candidate.fromVertex, candidate.toVertex)) {
+            continue;
+        }
+
+        collapse(candidate.fromVertex, candidate.toVertex, texCoordRemapping);
+
+        getNeighbours(candidate.toVertex, neighbours);
+        for (int neighbour : neighbours) {
+            pushCandidates(candidate.toVertex, neighbour);
+        }
+    }
+
+    return buildModel();
+}
+
+ObjModel QuadricSimplifier::buildModel() const {
+    // Drop the dead faces and every vertex and texture coordinate nothing refers to any more
+    std::vector<int> vertexRemapping(m_vertices.size(), -1);
+    std::vector<int> texCoordRemapping(m_textureCoordinates.size(), -1);
+    std::vector<Vector3f> vertices;
+    std::vector<Vector2f> textureCoordinates;
+    std::vector<ModelFace> faces;
+    faces.reserve(m_numAliveFaces);
+    for (size_t faceIndex = 0; faceIndex < m_faces.size(); ++faceIndex) {
+        if (!m_isFaceAlive[faceIndex]) {
+            continue;
+        }
+        ModelFace face = m_faces[faceIndex];
+        for (int i = 0; i < 3; ++i) {
+            ModelVertex &corner = face.vertices[i];
+            if (vertexRemapping[corner.positionIndex] < 0) {
+                vertexRemapping[corner.positionIndex] = static_cast<int>(vertices.size());
+                vertices.push_back(m_vertices[corner.positionIndex]);
+            }
+            corner.positionIndex = vertexRemapping[corner.positionIndex];
+
+            if (corner.texCoordIndex >= 0 && corner.texCoordIndex < static_cast<int>(m_textureCoordinates.size())) {
+                if (texCoordRemapping[corner.texCoordIndex] < 0) {
+                    texCoordRemapping[corner.texCoordIndex] = static_cast<int>(textureCoordinates.size());
+                    textureCoordinates.push_back(m_textureCoordinates[corner.texCoordIndex]);
+                }
+                corner.texCoordIndex = texCoordRemapping[corner.texCoordIndex];
+            }
+        }
+        faces.push_back(face);
+    }
+    return ObjModel(std::move(vertices), std::move(textureCoordinates), std::move(faces));
+}
+
+ObjModel simplifyModel(const ObjModel &model, size_t targetNumFaces) {
+    QuadricSimplifier simplifier(model);
+    return simplifier.simplify(targetNumFaces);
+}
+
+void ModelLODChain::build(const ObjModel &model, const std::vector<float> &faceRatios) {
+    m_sourceModel = &model;
+    m_simplifiedLevels.clear();
+    m_simplifiedLevels.reserve(faceRatios.size());
+
+    const ObjModel* previousLevel = &model;
+    for (float faceRatio : faceRatios) {
+        size_t targetNumFaces = static_cast<size_t>(model.numFaces() * faceRatio);
+        m_simplifiedLevels.push_back(simplifyModel(*previousLevel, targetNumFaces));
+        previousLevel = &m_simplifiedLevels.back();
+    }
+}
+
+const ObjModel &ModelLODChain::levelAtIndex(int index) const {
+    assert(index >= 0 && index < static_cast<int>(numLevels()));
+    return (index == 0) ? *m_sourceModel : m_simplifiedLevels[index - 1];
+}
+
+const ObjModel &ModelLODChain::levelForScreenSize(float projectedSize) const {
+    assert(m_sourceModel);
+    return levelAtIndex(getLevelIndexForScreenSize(levelFaceCounts(), projectedSize));
+}
+
+std::vector<size_t> ModelLODChain::levelFaceCounts() const {
+    std::vector<size_t> faceCounts;
+    for (size_t levelIndex = 0; levelIndex < numLevels(); ++levelIndex) {
+        faceCounts.push_back(levelAtIndex(static_cast<int>(levelIndex)).numFaces());
+    }
+    return faceCounts;
+}
+
+int getLevelIndexForScreenSize(const std::vector<size_t> &levelFaceCounts, float projectedSize) {
+    const float wantedNumFaces = (projectedSize * projectedSize) / TargetPixelsPerFace;
+
+    // Levels get coarser as the index goes up, so walk down from the coarsest
+    for (int levelIndex = static_cast<int>(levelFaceCounts.size()) - 1; levelIndex > 0; --levelIndex) {
+        if (levelFaceCounts[levelIndex] >= wantedNumFaces) {
+            return levelIndex;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+//
+//  ModelLOD.h
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/10/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#ifndef ModelLOD_hpp
+#define ModelLOD_hpp
+
+#include <vector>
+
+#include "ObjModel.h"
+
+// Simplifies the model down to (at most roughly) targetNumFaces faces by quadric error metric edge collapse
+// (Garland & Heckbert, "Surface Simplification Using Quadric Error Metrics", 1997).
+// Vertices only ever collapse onto existing vertices, and never in a way that would tear a UV seam open, so the
+// result can keep using the same texture. Boundaries and seams are weighted so that they keep their shape.
+ObjModel simplifyModel(const ObjModel &model, size_t targetNumFaces);
+
+// A model plus progressively simplified copies of it, for picking a cheaper mesh when it's small on screen
+class ModelLODChain {
+public:
+    ModelLODChain() = default;
+
+    // Level 0 is the source model itself (which must outlive the chain); level i is simplified to
+    // faceRatios[i-1] of its face count, each from the level before it
+    void build(const ObjModel &model, const std::vector<float> &faceRatios = { 0.5f, 0.25f, 0.1f });
+
+    size_t numLevels() const { return m_sourceModel ? m_simplifiedLevels.size() + 1 : 0; }
+    const ObjModel &levelAtIndex(int index) const;
+
+    // Picks the coarsest level that still has enough faces for a model that covers projectedSize pixels
+    // across (i.e. the larger of its on-screen width and height)
+    const ObjModel &levelForScreenSize(float projectedSize) const;
+    
+    // Face count of each level, finest first, for getLevelIndexForScreenSize()
+    std::vector<size_t> levelFaceCounts() const;
+
+private:
+    const ObjModel* m_sourceModel = nullptr;
+    std::vector<ObjModel> m_simplifiedLevels;
+};
+
+// The index of the level levelForScreenSize() would pick, for callers that have already released the chain and keep
+// the levels in some other form (e.g. as CompactModels)
+int getLevelIndexForScreenSize(const std::vector<size_t> &levelFaceCounts, float projectedSize);
+
+#endif /* ModelLOD_hpp */
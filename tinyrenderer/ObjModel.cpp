@@ -12,59 +12,321 @@
 #include <fstream>
 #include <sstream>
 #include <cassert>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <utility>
 
-void ObjModel::loadFromFile(std::string filePath) {
-    std::ifstream inputStream(filePath);
-    if (!inputStream.is_open()) {
-        std::cout << "Failed to open file: " << filePath << std::endl;
-        return;
+ObjLine parseObjLine(const std::string &nextLine) {
+    ObjLine line;
+    line.type = ObjLine::Other;
+    
+    std::istringstream lineStream(nextLine);
+    char charDiscard;
+    std::string stringDiscard;
+
+    if (nextLine.compare(0, 2, "v ") == 0) {
+        // Vector
+        // e.g. "v -0.000581696 -0.734665 -0.623267"
+        lineStream >> stringDiscard; // get rid of the "v "
+        lineStream >> line.vertex.x >> line.vertex.y >> line.vertex.z;
+        line.type = ObjLine::Vertex;
+    } else if (nextLine.compare(0, 3, "vt ") == 0) {
+        // Texture coordinates
+        // e.g. "vt 0.500 1"
+        lineStream >> stringDiscard; // get rid of "vt "
+        lineStream >> line.texCoord.x >> line.texCoord.y;
+        line.type = ObjLine::TexCoord;
+    } else if (nextLine.compare(0, 2, "f ") == 0) {
+        // Face
+        // e.g. "f 1258/1339/1258 1208/1256/1208 1206/1252/1206"
+        // Each entry is "position/texture/normal"
+        lineStream >> stringDiscard; // get rid of the "f "
+        int positions[3];
+        int texCoords[3];
+        lineStream >> positions[0] >> charDiscard >> texCoords[0] >> stringDiscard
+                   >> positions[1] >> charDiscard >> texCoords[1] >> stringDiscard
+                   >> positions[2] >> charDiscard >> texCoords[2] >> stringDiscard;
+        
+        for (int i = 0; i < 3; ++i) {
+            // OBJ indices are 1-based, so we subtract one to get it to map to our 0-based array
+            line.face.vertices[i].positionIndex = positions[i] - 1;
+            line.face.vertices[i].texCoordIndex = texCoords[i] - 1;
+        }
+        line.type = ObjLine::Face;
     }
     
+    return line;
+}
+
+ObjModel::ObjModel(std::vector<Vector3f> vertices, std::vector<Vector2f> textureCoordinates, std::vector<ModelFace> faces)
+: m_vertices(std::move(vertices))
+, m_textureCoordinates(std::move(textureCoordinates))
+, m_faces(std::move(faces))
+{
+}
+
+bool ObjModel::loadFromFile(std::string filePath, bool optimizeLayout) {
     m_vertices.clear();
     m_textureCoordinates.clear();
     m_faces.clear();
     
+    std::ifstream inputStream(filePath);
+    if (!inputStream.is_open()) {
+        std::cout << "Failed to open file: " << filePath << std::endl;
+        return false;
+    }
+    
     std::string nextLine;
     while (!inputStream.eof()) {
         std::getline(inputStream, nextLine);
         
-        std::istringstream lineStream(nextLine);
-        char charDiscard;
-        std::string stringDiscard;
-
-        if (nextLine.compare(0, 2, "v ") == 0) {
-            // Vector
-            // e.g. "v -0.000581696 -0.734665 -0.623267"
-            Vector3f vertexData;
-            lineStream >> stringDiscard; // get rid of the "v "
-            lineStream >> vertexData.x >> vertexData.y >> vertexData.z;
-            m_vertices.push_back(vertexData);
-        } else if (nextLine.compare(0, 3, "vt ") == 0) {
-            // Texture coordinates
-            // e.g. "vt 0.500 1"
-            Vector2f texCoord;
-            lineStream >> stringDiscard; // get rid of "vt "
-            lineStream >> texCoord.x >> texCoord.y;
-            m_textureCoordinates.push_back(texCoord);
-        } else if (nextLine.compare(0, 2, "f ") == 0) {
-            // Face
-            // e.g. "f 1258/1339/1258 1208/1256/1208 1206/1252/1206"
-            // Each entry is "position/texture/normal"
-            lineStream >> stringDiscard; // get rid of the "f "
-            int positions[3];
-            int texCoords[3];
-            lineStream >> positions[0] >> charDiscard >> texCoords[0] >> stringDiscard
-                       >> positions[1] >> charDiscard >> texCoords[1] >> stringDiscard
-                       >> positions[2] >> charDiscard >> texCoords[2] >> stringDiscard;
+        ObjLine line = parseObjLine(nextLine);
+        switch (line.type) {
+            case ObjLine::Vertex:   m_vertices.push_back(line.vertex); break;
+            case ObjLine::TexCoord: m_textureCoordinates.push_back(line.texCoord); break;
+            case ObjLine::Face:     m_faces.push_back(line.face); break;
+            case ObjLine::Other:    break;
+        }
+    }
+    
+    // Everything downstream indexes straight into the vertex arrays, so this is the one place bad indices get caught
+    if (!hasValidIndices()) {
+        std::cout << "Face refers to a vertex or texture coordinate that doesn't exist: " << filePath << std::endl;
+        *this = ObjModel();
+        return false;
+    }
+    
+    if (optimizeLayout) {
+        this->optimizeLayout();
+    }
+    return true;
+}
+
+// Spreads the low 10 bits of value out so there are two zero bits between each of them
+static uint32_t expandBitsForMorton(uint32_t value) {
+    value &= 0x3ff;
+    value = (value | (value << 16)) & 0x030000ff;
+    value = (value | (value << 8))  & 0x0300f00f;
+    value = (value | (value << 4))  & 0x030c30c3;
+    value = (value | (value << 2))  & 0x09249249;
+    return value;
+}
+
+static std::vector<int> getFaceOrderByMortonCode(const std::vector<ModelFace> &faces, const std::vector<Vector3f> &vertices) {
+    const size_t numFaces = faces.size();
+    std::vector<Vector3f> centroids(numFaces);
+    Vector3f boundsMin( std::numeric_limits<float>::max(),  std::numeric_limits<float>::max(),  std::numeric_limits<float>::max());
+    Vector3f boundsMax(std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest());
+    for (size_t faceIndex = 0; faceIndex < numFaces; ++faceIndex) {
+        Vector3f centroid;
+        for (int i = 0; i < 3; ++i) {
+            const Vector3f &vertex = vertices[faces[faceIndex].vertices[i].positionIndex];
+            for (int axis = 0; axis < 3; ++axis) {
+                centroid[axis] += vertex[axis] / 3.f;
+            }
+        }
+        for (int axis = 0; axis < 3; ++axis) {
+            boundsMin[axis] = std::min(boundsMin[axis], centroid[axis]);
+            boundsMax[axis] = std::max(boundsMax[axis], centroid[axis]);
+        }
+        centroids[faceIndex] = centroid;
+    }
+    
+    std::vector<uint32_t> mortonCodes(numFaces);
+    for (size_t faceIndex = 0; faceIndex < numFaces; ++faceIndex) {
+        uint32_t code = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            float extent = boundsMax[axis] - boundsMin[axis];
+            float normalized = (extent > 0) ? (centroids[faceIndex][axis] - boundsMin[axis]) / extent : 0.f;
+            uint32_t quantized = static_cast<uint32_t>(normalized * 1023.f);
+            code |= expandBitsForMorton(quantized) << (2 - axis);
+        }
+        mortonCodes[faceIndex] = code;
+    }
+    
+    std::vector<int> order(numFaces);
+    for (size_t faceIndex = 0; faceIndex < numFaces; ++faceIndex) {
+        order[faceIndex] = static_cast<int>(faceIndex);
+    }
+    std::stable_sort(order.begin(), order.end(), [&mortonCodes](int lhs, int rhs) {
+        return mortonCodes[lhs] < mortonCodes[rhs];
+    });
+    return order;
+}
+
+// Tipsify, from Sander, Nehab & Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (2007).
+// Faces are fanned out around a "current" vertex, preferring next vertices that are still in the simulated cache.
+// When it runs out of those it falls back to the next unemitted face of the input order, which here is Morton order,
+// so jumps land somewhere spatially close rather than at an arbitrary file position.
+static std::vector<int> getFaceOrderForVertexCache(const std::vector<ModelFace> &faces, const std::vector<int> &inputOrder, size_t numVertices, int cacheSize) {
+    const size_t numFaces = inputOrder.size();
+    
+    // Vertex -> adjacent faces, stored flat: faces of vertex v are adjacentFaces[adjacencyOffsets[v] ... adjacencyOffsets[v+1])
+    std::vector<int> liveFaceCounts(numVertices, 0);
+    for (const ModelFace &face : faces) {
+        for (int i = 0; i < 3; ++i) {
+            liveFaceCounts[face.vertices[i].positionIndex]++;
+        }
+    }
+    std::vector<int> adjacencyOffsets(numVertices + 1, 0);
+    for (size_t vertexIndex = 0; vertexIndex < numVertices; ++vertexIndex) {
+        adjacencyOffsets[vertexIndex + 1] = adjacencyOffsets[vertexIndex] + liveFaceCounts[vertexIndex];
+    }
+    std::vector<int> adjacentFaces(adjacencyOffsets[numVertices]);
+    std::vector<int> fillCounts(numVertices, 0);
+    for (int faceIndex : inputOrder) {
+        for (int i = 0; i < 3; ++i) {
+            int vertexIndex = faces[faceIndex].vertices[i].positionIndex;
+            adjacentFaces[adjacencyOffsets[vertexIndex] + fillCounts[vertexIndex]++] = faceIndex;
+        }
+    }
+    
+    std::vector<int> cacheTimeStamps(numVertices, 0);
+    std::vector<bool> isFaceEmitted(faces.size(), false);
+    std::vector<int> deadEndStack;
+    std::vector<int> candidates;
+    std::vector<int> outputOrder;
+    outputOrder.reserve(numFaces);
+    
+    int timeStamp = cacheSize + 1;
+    size_t inputCursor = 0;
+    int currentVertex = numFaces > 0 ? faces[inputOrder[0]].vertices[0].positionIndex : -1;
+    while (currentVertex >= 0) {
+        candidates.clear();
+        for (int adjacencyIndex = adjacencyOffsets[currentVertex]; adjacencyIndex < adjacencyOffsets[currentVertex + 1]; ++adjacencyIndex) {
+            int faceIndex = adjacentFaces[adjacencyIndex];
+            if (isFaceEmitted[faceIndex]) {
+                continue;
+            }
             
-            ModelFace modelFace;
             for (int i = 0; i < 3; ++i) {
-                // OBJ indices are 1-based, so we subtract one to get it to map to our 0-based array
-                modelFace.vertices[i].positionIndex = positions[i] - 1;
-                modelFace.vertices[i].texCoordIndex = texCoords[i] - 1;
+                int vertexIndex = faces[faceIndex].vertices[i].positionIndex;
+                deadEndStack.push_back(vertexIndex);
+                candidates.push_back(vertexIndex);
+                liveFaceCounts[vertexIndex]--;
+                if (timeStamp - cacheTimeStamps[vertexIndex] > cacheSize) {
+                    cacheTimeStamps[vertexIndex] = timeStamp++;
+                }
+            }
+            isFaceEmitted[faceIndex] = true;
+            outputOrder.push_back(faceIndex);
+        }
+        
+        // Prefer the candidate that will still be in the cache once all of its remaining faces have been emitted
+        int nextVertex = -1;
+        int bestPriority = -1;
+        for (int vertexIndex : candidates) {
+            if (liveFaceCounts[vertexIndex] <= 0) {
+                continue;
+            }
+            int priority = 0;
+            int age = timeStamp - cacheTimeStamps[vertexIndex];
+            if (age + 2 * liveFaceCounts[vertexIndex] <= cacheSize) {
+                priority = age;
+            }
+            if (priority > bestPriority) {
+                bestPriority = priority;
+                nextVertex = vertexIndex;
+            }
+        }
+        
+        while (nextVertex < 0 && !deadEndStack.empty()) {
+            int vertexIndex = deadEndStack.back();
+            deadEndStack.pop_back();
+            if (liveFaceCounts[vertexIndex] > 0) {
+                nextVertex = vertexIndex;
+            }
+        }
+        
+        while (nextVertex < 0 && inputCursor < numFaces) {
+            int faceIndex = inputOrder[inputCursor++];
+            if (!isFaceEmitted[faceIndex]) {
+                nextVertex = faces[faceIndex].vertices[0].positionIndex;
+            }
+        }
+        
+        currentVertex = nextVertex;
+    }
+    
+    return outputOrder;
+}
+
+// Maps old index -> new index so that indices are numbered in order of first use by the faces.
+// Entries nothing refers to keep their relative order at the end.
+static std::vector<int> getFirstUseRemapping(const std::vector<ModelFace> &faces, size_t count, int ModelVertex::*indexMember) {
+    std::vector<int> remapping(count, -1);
+    int nextIndex = 0;
+    for (const ModelFace &face : faces) {
+        for (int i = 0; i < 3; ++i) {
+            int oldIndex = face.vertices[i].*indexMember;
+            if (oldIndex >= 0 && (size_t)oldIndex < count && remapping[oldIndex] < 0) {
+                remapping[oldIndex] = nextIndex++;
+            }
+        }
+    }
+    for (size_t oldIndex = 0; oldIndex < count; ++oldIndex) {
+        if (remapping[oldIndex] < 0) {
+            remapping[oldIndex] = nextIndex++;
+        }
+    }
+    return remapping;
+}
+
+template<typename T>
+static void applyRemapping(std::vector<T> &elements, const std::vector<int> &remapping) {
+    std::vector<T> remapped(elements.size());
+    for (size_t oldIndex = 0; oldIndex < elements.size(); ++oldIndex) {
+        remapped[remapping[oldIndex]] = elements[oldIndex];
+    }
+    elements.swap(remapped);
+}
+
+bool ObjModel::hasValidIndices() const {
+    for (const ModelFace &face : m_faces) {
+        for (int i = 0; i < 3; ++i) {
+            const ModelVertex &corner = face.vertices[i];
+            if (corner.positionIndex < 0 || static_cast<size_t>(corner.positionIndex) >= m_vertices.size()
+                || corner.texCoordIndex < 0 || static_cast<size_t>(corner.texCoordIndex) >= m_textureCoordinates.size()) {
+                return false;
             }
-            
-            m_faces.push_back(modelFace);
+        }
+    }
+    return true;
+}
+
+void ObjModel::optimizeLayout() {
+    if (m_faces.empty()) {
+        return;
+    }
+    // Every pass below indexes per-vertex arrays with positionIndex, so a bad index would write out of bounds
+    if (!hasValidIndices()) {
+        std::cout << "Not optimizing layout: a face refers to a vertex or texture coordinate that doesn't exist" << std::endl;
+        return;
+    }
+    
+    // Matches the usual 16-32 entry post-transform caches, and is what the Tipsify paper tunes for
+    const int VertexCacheSize = 16;
+    
+    std::vector<int> spatialOrder = getFaceOrderByMortonCode(m_faces, m_vertices);
+    std::vector<int> faceOrder = getFaceOrderForVertexCache(m_faces, spatialOrder, m_vertices.size(), VertexCacheSize);
+    
+    std::vector<ModelFace> reorderedFaces;
+    reorderedFaces.reserve(m_faces.size());
+    for (int faceIndex : faceOrder) {
+        reorderedFaces.push_back(m_faces[faceIndex]);
+    }
+    m_faces.swap(reorderedFaces);
+    
+    std::vector<int> positionRemapping = getFirstUseRemapping(m_faces, m_vertices.size(), &ModelVertex::positionIndex);
+    std::vector<int> texCoordRemapping = getFirstUseRemapping(m_faces, m_textureCoordinates.size(), &ModelVertex::texCoordIndex);
+    applyRemapping(m_vertices, positionRemapping);
+    applyRemapping(m_textureCoordinates, texCoordRemapping);
+    for (ModelFace &face : m_faces) {
+        for (int i = 0; i < 3; ++i) {
+            ModelVertex &vertex = face.vertices[i];
+            vertex.positionIndex = positionRemapping[vertex.positionIndex];
+            vertex.texCoordIndex = texCoordRemapping[vertex.texCoordIndex];
         }
     }
 }
@@ -79,6 +341,14 @@ Vector2f ObjModel::texCoordAtIndex(int index) const {
     return m_textureCoordinates[index];
 }
 
+BoundingBox ObjModel::bounds() const {
+    BoundingBox bounds;
+    for (const Vector3f &vertex : m_vertices) {
+        bounds.grow(vertex);
+    }
+    return bounds;
+}
+
 ModelFace ObjModel::faceAtIndex(int index) const {
     assert(index >= 0 && index < m_faces.size());
     return m_faces[index];
@@ -12,6 +12,7 @@
 #include <vector>
 #include <string>
 
+#include "BoundingBox.hpp"
 #include "Vector.hpp"
 
 struct ModelVertex {
@@ -23,13 +24,40 @@ struct ModelFace {
     ModelVertex vertices[3];
 };
 
+// One parsed line of an OBJ file; only the member matching type is filled in
+struct ObjLine {
+    enum Type { Vertex, TexCoord, Face, Other };
+    
+    Type type;
+    Vector3f vertex;
+    Vector2f texCoord;
+    ModelFace face; // With 0-based indices
+};
+
+// Shared by ObjModel::loadFromFile() and anything else that needs to read OBJ files a line at a time
+ObjLine parseObjLine(const std::string &line);
+
 class ObjModel {
 public:
     ObjModel() = default;
+    ObjModel(std::vector<Vector3f> vertices, std::vector<Vector2f> textureCoordinates, std::vector<ModelFace> faces);
+    
+    // If optimizeLayout is set, optimizeLayout() is run on the freshly loaded mesh. Returns false, leaving the model
+    // empty, if the file can't be opened or a face refers to a vertex or texture coordinate that doesn't exist.
+    bool loadFromFile(std::string filePath, bool optimizeLayout = false);
+    
+    // Reorders faces for spatial coherence (Morton order of face centroids) and post-transform vertex cache reuse
+    // (Tipsify), then renumbers vertices and texture coordinates in order of first use. The mesh itself is unchanged.
+    // Does nothing if hasValidIndices() is false.
+    void optimizeLayout();
     
-    void loadFromFile(std::string filePath);
+    // True if every face refers only to vertices and texture coordinates that exist
+    bool hasValidIndices() const;
     
     size_t numFaces() const { return m_faces.size(); }
+    size_t numVertices() const { return m_vertices.size(); }
+    size_t numTexCoords() const { return m_textureCoordinates.size(); }
+    BoundingBox bounds() const;
     Vector3f vertexAtIndex(int index) const;
     Vector2f texCoordAtIndex(int index) const;
     ModelFace faceAtIndex(int index) const;
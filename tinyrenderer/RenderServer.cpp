@@ -0,0 +1,241 @@
+//
+//  RenderServer.cpp
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/18/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#include "RenderServer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "SocketIO.h"
+
+// Only a sanity check on each side. What a render needs depends on how it's drawn (e.g. MSAA targets are many
+// times the image), so the render function has to set the real limit.
+static const int MaxImageSize = 4096;
+// Images up to this size (which covers 1024x1024) are kept for the thread's next request; bigger ones are freed
+static const size_t RetainedImageBytes = 4 * 1024 * 1024;
+static const size_t MaxRequestLength = 4096;
+// A client that connects and then stalls mustn't hold on to a render thread
+static const int ReceiveTimeoutSeconds = 5;
+static const int SendTimeoutSeconds = 30;
+
+bool parseRenderRequest(const std::string &line, RenderRequest &outRequest, std::string &outError) {
+    outRequest = RenderRequest();
+    std::istringstream lineStream(line);
+    std::string field;
+    while (lineStream >> field) {
+        const size_t separator = field.find('=');
+        if (separator == std::string::npos) {
+            outError = "expected key=value: " + field;
+            return false;
+        }
+        const std::string key = field.substr(0, separator);
+        std::istringstream valueStream(field.substr(separator + 1));
+        char comma1 = 0, comma2 = 0, comma3 = 0, times = 0;
+
+        if (key == "asset") {
+            outRequest.asset = valueStream.str();
+        } else if (key == "texture") {
+            outRequest.texture = valueStream.str();
+        } else if (key == "output") {
+            outRequest.outputPath = valueStream.str();
+        } else if (key == "view") {
+            valueStream >> outRequest.viewMinX >> comma1 >> outRequest.viewMinY >> comma2
+                        >> outRequest.viewMaxX >> comma3 >> outRequest.viewMaxY;
+            if (valueStream.fail() || comma1 != ',' || comma2 != ',' || comma3 != ','
+                || !(outRequest.viewMaxX > outRequest.viewMinX) || !(outRequest.viewMaxY > outRequest.viewMinY)) {
+                outError = "view must be minX,minY,maxX,maxY with max > min";
+                return false;
+            }
+        } else if (key == "size") {
+            valueStream >> outRequest.width >> times >> outRequest.height;
+            if (valueStream.fail() || times != 'x'
+                || outRequest.width <= 0 || outRequest.width > MaxImageSize
+                || outRequest.height <= 0 || outRequest.height > MaxImageSize) {
+                outError = "size must be WxH, at most " + std::to_string(MaxImageSize) + " each way";
+                return false;
+            }
+        } else if (key == "format") {
+            if (valueStream.str() == "tga") {
+                outRequest.rle = true;
+            } else if (valueStream.str() == "rawtga") {
+                outRequest.rle = false;
+            } else {
+                outError = "format must be tga or rawtga";
+                return false;
+            }
+        } else {
+            outError = "unknown key: " + key;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool readLine(int connection, std::string &outLine) {
+    outLine.clear();
+    char buffer[512];
+    while (outLine.size() < MaxRequestLength) {
+        ssize_t numRead = recv(connection, buffer, sizeof(buffer), 0);
+        if (numRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (numRead <= 0) {
+            // The client may have closed its end after sending a request with no newline
+            return numRead == 0 && !outLine.empty();
+        }
+        outLine.append(buffer, numRead);
+        const size_t newline = outLine.find('\n');
+        if (newline != std::string::npos) {
+            outLine.resize((newline > 0 && outLine[newline - 1] == '\r') ? newline - 1 : newline);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void sendError(int connection, const std::string &reason) {
+    const std::string reply = "ERROR " + reason + "\n";
+    writeAll(connection, reply.data(), reply.size());
+}
+
+RenderServer::RenderServer(RenderFunction render, int numThreads, size_t maxQueuedConnections)
+: m_render(std::move(render))
+, m_numThreads(std::max(numThreads, 1))
+, m_connections(std::max<size_t>(maxQueuedConnections, 1))
+{
+}
+
+RenderServer::~RenderServer() {
+    m_connections.close();
+    for (std::thread &worker : m_workers) {
+        worker.join();
+    }
+}
+
+bool RenderServer::run(const std::string &socketPath) {
+    // A client hanging up mid-reply should fail that write, not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << socketPath << std::endl;
+        return false;
+    }
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    int listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenSocket < 0) {
+        perror("socket");
+        return false;
+    }
+    unlink(socketPath.c_str());
+    if (bind(listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(listenSocket, SOMAXCONN) < 0) {
+        perror(socketPath.c_str());
+        close(listenSocket);
+        return false;
+    }
+
+    for (int i = 0; i < m_numThreads; ++i) {
+        m_workers.emplace_back(&RenderServer::workerLoop, this);
+    }
+    std::cout << "Serving renders on " << socketPath << " with " << m_numThreads << " threads" << std::endl;
+
+    while (true) {
+        int connection = accept(listenSocket, nullptr, nullptr);
+        if (connection < 0) {
+            if (errno != EINTR) {
+                perror("accept");
+            }
+            continue;
+        }
+
+        timeval receiveTimeout = { ReceiveTimeoutSeconds, 0 };
+        timeval sendTimeout = { SendTimeoutSeconds, 0 };
+        setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &receiveTimeout, sizeof(receiveTimeout));
+        setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+
+        // Blocks while the queue is full, which is the backpressure: nothing more is accepted until a thread frees up
+        m_connections.push(connection);
+    }
+}
+
+void RenderServer::workerLoop() {
+    // Reused from one request to the next as long as the size stays the same
+    TGAImage image;
+    int connection;
+    while (m_connections.pop(connection)) {
+        handleConnection(connection, image);
+        close(connection);
+        if (static_cast<size_t>(image.get_width()) * image.get_height() * image.get_bytespp() > RetainedImageBytes) {
+            image = TGAImage();
+        }
+    }
+}
+
+void RenderServer::handleConnection(int connection, TGAImage &image) {
+    std::string line;
+    if (!readLine(connection, line)) {
+        sendError(connection, "couldn't read request");
+        return;
+    }
+
+    RenderRequest request;
+    std::string error;
+    if (!parseRenderRequest(line, request, error)) {
+        sendError(connection, error);
+        return;
+    }
+
+    if (image.get_width() != request.width || image.get_height() != request.height) {
+        image = TGAImage(request.width, request.height, TGAImage::RGB);
+    } else {
+        image.clear();
+    }
+    if (!m_render(request, image, error)) {
+        sendError(connection, error);
+        return;
+    }
+
+    image.flip_vertically(); // i want to have the origin at the left bottom corner of the image
+    std::ostringstream encodedStream;
+    if (!image.write_tga(encodedStream, request.rle)) {
+        sendError(connection, "couldn't encode image");
+        return;
+    }
+    const std::string encodedData = encodedStream.str();
+
+    if (!request.outputPath.empty()) {
+        std::ofstream outputStream(request.outputPath, std::ios::binary);
+        outputStream.write(encodedData.data(), encodedData.size());
+        if (!outputStream.good()) {
+            sendError(connection, "couldn't write " + request.outputPath);
+            return;
+        }
+        const std::string reply = "OK 0\n";
+        writeAll(connection, reply.data(), reply.size());
+        return;
+    }
+
+    const std::string header = "OK " + std::to_string(encodedData.size()) + "\n";
+    if (!writeAll(connection, header.data(), header.size()) || !writeAll(connection, encodedData.data(), encodedData.size())) {
+        std::cerr << "Client went away before its image was sent" << std::endl;
+    }
+}
@@ -0,0 +1,72 @@
+//
+//  RenderServer.h
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/18/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#ifndef RenderServer_hpp
+#define RenderServer_hpp
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BlockingQueue.hpp"
+#include "tgaimage.h"
+
+// One render, as sent by a client. Every field has a default, so an empty request renders the head.
+struct RenderRequest {
+    std::string asset = "head";  // "head", or the path of an OBJ file
+    std::string texture;         // Diffuse texture for an OBJ asset
+    float viewMinX = -1.f;       // Region of model space mapped onto the image, as for ViewRect
+    float viewMinY = -1.f;
+    float viewMaxX = 1.f;
+    float viewMaxY = 1.f;
+    int width = 800;
+    int height = 800;
+    bool rle = true;             // format=tga (RLE) or format=rawtga (uncompressed)
+    std::string outputPath;      // Write the image here instead of sending it back
+};
+
+// Parses "key=value" pairs separated by spaces: asset, texture, view=minX,minY,maxX,maxY, size=WxH,
+// format=tga|rawtga and output. Returns false (with a reason) for anything it doesn't understand.
+bool parseRenderRequest(const std::string &line, RenderRequest &outRequest, std::string &outError);
+
+// Serves renders over a Unix domain socket, so that clients skip loading and preprocessing assets on every render.
+//
+// Each connection carries one request: a single line as parseRenderRequest() understands it. The reply is
+// "OK <n>\n" followed by n bytes of TGA file (n is 0 if the request named an output path), or "ERROR <reason>\n".
+//
+// Connections are handed to a fixed pool of render threads through a bounded queue. When every thread is busy and
+// the queue is full, the server stops accepting, and further clients wait in the socket's listen backlog.
+class RenderServer {
+public:
+    // Called on a pool thread to draw the request into image, which is already request.width x request.height and
+    // cleared. Returns false (with a reason) if it can't, including if the size would need more memory than one
+    // render should have. Must be safe to call from several threads at once.
+    typedef std::function<bool(const RenderRequest &request, TGAImage &image, std::string &outError)> RenderFunction;
+
+    RenderServer(RenderFunction render, int numThreads, size_t maxQueuedConnections);
+    ~RenderServer();
+
+    RenderServer(const RenderServer &) = delete;
+    RenderServer &operator=(const RenderServer &) = delete;
+
+    // Listens on socketPath (replacing any stale socket file) and serves requests until the process exits.
+    // Only returns if the socket can't be set up.
+    bool run(const std::string &socketPath);
+
+private:
+    void workerLoop();
+    void handleConnection(int connection, TGAImage &image);
+
+    RenderFunction m_render;
+    int m_numThreads;
+    BlockingQueue<int> m_connections;
+    std::vector<std::thread> m_workers;
+};
+
+#endif /* RenderServer_hpp */
@@ -0,0 +1,45 @@
+//
+//  SocketIO.cpp
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/19/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#include "SocketIO.h"
+
+#include <cerrno>
+
+#include <unistd.h>
+
+bool writeAll(int socket, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t numWritten = write(socket, bytes, size);
+        if (numWritten < 0 && errno == EINTR) {
+            continue;
+        }
+        if (numWritten <= 0) {
+            return false;
+        }
+        bytes += numWritten;
+        size -= numWritten;
+    }
+    return true;
+}
+
+bool readAll(int socket, void* data, size_t size) {
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t numRead = read(socket, bytes, size);
+        if (numRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (numRead <= 0) {
+            return false;
+        }
+        bytes += numRead;
+        size -= numRead;
+    }
+    return true;
+}
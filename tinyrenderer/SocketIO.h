@@ -0,0 +1,19 @@
+//
+//  SocketIO.h
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/19/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#ifndef SocketIO_hpp
+#define SocketIO_hpp
+
+#include <cstddef>
+
+// Blocking reads and writes on a socket (or any file descriptor) that carry on through short transfers and
+// EINTR. Both return false if the connection fails or closes before all size bytes have been moved.
+bool writeAll(int socket, const void* data, size_t size);
+bool readAll(int socket, void* data, size_t size);
+
+#endif /* SocketIO_hpp */
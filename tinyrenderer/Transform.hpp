@@ -0,0 +1,57 @@
+//
+//  Transform.hpp
+//  tinyrenderer
+//
+//  Created by Scarlett Hoefler on 2/17/19.
+//  Copyright © 2019 Scarlett Hoefler. All rights reserved.
+//
+
+#ifndef Transform_hpp
+#define Transform_hpp
+
+#include <cmath>
+
+#include "BoundingBox.hpp"
+#include "Vector.hpp"
+
+// Affine transform from model space to world space. The axes are the images of the model's x, y and z unit
+// vectors (i.e. the columns of the 3x3 part), so applying it is
+//     xAxis * p.x + yAxis * p.y + zAxis * p.z + translation
+struct Transform {
+    Vector3f xAxis;
+    Vector3f yAxis;
+    Vector3f zAxis;
+    Vector3f translation;
+
+    static Transform identity() {
+        return { Vector3f(1.f, 0.f, 0.f), Vector3f(0.f, 1.f, 0.f), Vector3f(0.f, 0.f, 1.f), Vector3f(0.f, 0.f, 0.f) };
+    }
+
+    // Uniform scale, then a rotation of angle radians about the y axis, then a translation
+    static Transform placement(const Vector3f &translation, float scale, float angle) {
+        const float c = std::cos(angle) * scale;
+        const float s = std::sin(angle) * scale;
+        return { Vector3f(c, 0.f, -s), Vector3f(0.f, scale, 0.f), Vector3f(s, 0.f, c), translation };
+    }
+
+    Vector3f apply(const Vector3f &point) const {
+        return xAxis * point.x + yAxis * point.y + zAxis * point.z + translation;
+    }
+
+    // A box around the transformed corners of bounds
+    BoundingBox apply(const BoundingBox &bounds) const {
+        BoundingBox transformed;
+        if (bounds.isEmpty()) {
+            return transformed;
+        }
+        for (int corner = 0; corner < 8; ++corner) {
+            Vector3f point((corner & 1) ? bounds.max.x : bounds.min.x,
+                           (corner & 2) ? bounds.max.y : bounds.min.y,
+                           (corner & 4) ? bounds.max.z : bounds.min.z);
+            transformed.grow(apply(point));
+        }
+        return transformed;
+    }
+};
+
+#endif /* Transform_hpp */
@@ -56,10 +56,12 @@ struct Vector3 {
     Vector3<T> normalized() const;
     float magnitude() const;
     
+    Vector3<T> operator+(const Vector3 &rhs) const;
     Vector3<T> operator-(const Vector3 &rhs) const;
     Vector3<T> operator*(float rhs) const;
     
-    T& operator[](int index) const;
+    T& operator[](int index);
+    const T& operator[](int index) const;
 };
 
 typedef Vector3<float> Vector3f;
@@ -96,6 +98,11 @@ float Vector3<T>::magnitude() const {
     return std::sqrt(x*x + y*y + z*z);
 }
 
+template<typename T>
+Vector3<T> Vector3<T>::operator+(const Vector3 &rhs) const {
+    return Vector3(x+rhs.x, y+rhs.y, z+rhs.z);
+}
+
 template<typename T>
 Vector3<T> Vector3<T>::operator-(const Vector3 &rhs) const {
     return Vector3(x-rhs.x, y-rhs.y, z-rhs.z);
@@ -112,7 +119,12 @@ Vector3<T> operator*(float x, const Vector3<T> &rhs) {
 }
 
 template<typename T>
-T& Vector3<T>::operator[](int index) const {
+T& Vector3<T>::operator[](int index) {
+    return raw[index];
+}
+
+template<typename T>
+const T& Vector3<T>::operator[](int index) const {
     return raw[index];
 }
 
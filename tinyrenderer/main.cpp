@@ -1,10 +1,30 @@
 #include "tgaimage.h"
 #include "ObjModel.h"
+#include "ModelBVH.h"
+#include "ModelLOD.h"
+#include "FramePipeline.h"
+#include "ChunkedMesh.h"
+#include "CompactModel.h"
+#include "FrameArena.h"
+#include "Transform.hpp"
+#include "RenderServer.h"
+#include "DistributedRender.h"
 #include "Vector.hpp"
 #include <iostream>
 #include <cassert>
 #include <cmath>
 #include <random>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <iomanip>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
 
 const TGAColor white = TGAColor(255, 255, 255, 255);
 const TGAColor red   = TGAColor(255, 0,   0,   255);
@@ -14,6 +34,29 @@ const TGAColor blue  = TGAColor(0,   0,   255, 255);
 const int ImageWidth = 800;
 const int ImageHeight = 800;
 
+const bool UseDepthPrepass = true;
+const bool OptimizeMeshLayout = true;
+// Building the chain costs more than it saves for a single render, so one-shot renders from the command line
+// skip it. The render server builds it once per cached scene and then serves every thumbnail size from it.
+const bool UseLevelsOfDetail = false;
+const bool ServerUsesLevelsOfDetail = true;
+// Keep only quantized copies of the meshes (see CompactModel.h). Halves the memory each model holds and vertex
+// fetch reads, at the cost of moving vertices by up to half a 16-bit step.
+const bool UseCompactMeshes = true;
+// Samples per pixel for the shaded render. 1 rasterizes pixel centers only; 4 and 8 turn on MSAA.
+const int MultisampleCount = 4;
+static_assert(MultisampleCount == 1 || MultisampleCount == 4 || MultisampleCount == 8, "getSamplePattern() only has 1x, 4x and 8x patterns");
+// Faces per chunk when an OBJ has to be converted for "--stream". This (not the model) bounds the memory used.
+const size_t StreamingFacesPerChunk = 65536;
+
+// The region of model space (in x/y) that gets mapped onto the whole image. Shrink it to zoom in.
+struct ViewRect {
+    float minX, minY;
+    float maxX, maxY;
+};
+
+const ViewRect FullView = { -1.f, -1.f, 1.f, 1.f };
+
 void line(int x0, int y0, int x1, int y1, TGAImage &image, TGAColor color) {
     const bool tallerThanWide = std::abs(y0-y1) > std::abs(x0-x1);
     
@@ -79,7 +122,12 @@ T clamp(T val, T min, T max) {
     return val;
 }
 
-void triangle(const Vector3f points[3], const Vector2f texCoords[3], const TGAImage &diffuseTexture, TGAImage &image, float* zBuffer) {
+struct ScreenRect {
+    int minX, minY;
+    int maxX, maxY;
+};
+
+ScreenRect getScreenBoundsForTriangle(const Vector3f points[3], int imageWidth, int imageHeight) {
     // Find the bounding rect of our triangle (in pixel coords) so that we only have to iterate over a small area
     const float floatMin = std::numeric_limits<float>::lowest();
     const float floatMax = std::numeric_limits<float>::max();
@@ -96,20 +144,54 @@ void triangle(const Vector3f points[3], const Vector2f texCoords[3], const TGAIm
     }
     
     // Clamp to image bounds
-    const float imageCoordMaxX = image.get_width() - 1;
-    const float imageCoordMaxY = image.get_height() - 1;
+    const float imageCoordMaxX = imageWidth - 1;
+    const float imageCoordMaxY = imageHeight - 1;
     minX = clamp(minX, 0.f, imageCoordMaxX);
     minY = clamp(minY, 0.f, imageCoordMaxY);
     maxX = clamp(maxX, 0.f, imageCoordMaxX);
-    maxY = clamp(maxY, 0.f, imageCoordMaxX);
+    maxY = clamp(maxY, 0.f, imageCoordMaxY);
+    
+    ScreenRect rect;
+    rect.minX = (int)std::floor(minX);
+    rect.maxX = (int)std::ceil(maxX);
+    rect.minY = (int)std::floor(minY);
+    rect.maxY = (int)std::ceil(maxY);
+    return rect;
+}
+
+float interpolateDepth(const Vector3f points[3], const Vector3f &barycentricCoords) {
+    // Both the depth-only and the shaded kernel go through here, so a Z-prepass and the colour pass that follows
+    // it produce bit-identical depths and DepthTest::Equal can be an exact comparison
+    float zPos = 0;
+    for (int i = 0; i < 3; ++i) {
+        zPos += points[i].z * barycentricCoords[i];
+    }
+    return zPos;
+}
+
+TGAColor shadeFragment(const Vector2f texCoords[3], const Vector3f &barycentricCoords, const TGAImage &diffuseTexture) {
+    Vector2f uv(0,0);
+    for (int i = 0; i < 3; ++i) {
+        uv.u += texCoords[i].u * barycentricCoords[i];
+        uv.v += texCoords[i].v * barycentricCoords[i];
+    }
+    
+    Vector2i colorPos((int)std::round(uv.u * diffuseTexture.get_width()),
+                      (int)std::round(uv.v * diffuseTexture.get_height()));
+    return diffuseTexture.get(colorPos.x, colorPos.y);
+}
+
+enum class DepthTest {
+    Greater, // Normal rendering: keep the closest fragment and write its depth
+    Equal,   // After a Z-prepass: the z-buffer is already final, so only shade the fragment that produced it
+};
+
+void triangle(const Vector3f points[3], const Vector2f texCoords[3], const TGAImage &diffuseTexture, TGAImage &image, float* zBuffer, DepthTest depthTest = DepthTest::Greater) {
+    const ScreenRect rect = getScreenBoundsForTriangle(points, image.get_width(), image.get_height());
     
     // For each point in our bounding rect, check if our point is within our triangle. If so, draw!
-    int minScreenX = (int)std::floor(minX);
-    int maxScreenX = (int)std::ceil(maxX);
-    int minScreenY = (int)std::floor(minY);
-    int maxScreenY = (int)std::ceil(maxY);
-    for (int xPos = minScreenX; xPos <= maxScreenX; ++xPos) {
-        for (int yPos = minScreenY; yPos <= maxScreenY; ++yPos) {
+    for (int xPos = rect.minX; xPos <= rect.maxX; ++xPos) {
+        for (int yPos = rect.minY; yPos <= rect.maxY; ++yPos) {
             Vector3f screenPoint(xPos, yPos, 0);
             Vector3f barycentricCoords = getBarycentricCoordinatesForScreenPoint(points[0], points[1], points[2], screenPoint);
             bool isPointInsideTriangle =    (barycentricCoords.x >= 0)
@@ -117,26 +199,18 @@ void triangle(const Vector3f points[3], const Vector2f texCoords[3], const TGAIm
                                          && (barycentricCoords.z >= 0);
             
             if (isPointInsideTriangle) {
-                float zPos = 0;
-                for (int i = 0; i < 3; ++i) {
-                    zPos += points[i].z * barycentricCoords[i];
-                }
+                float zPos = interpolateDepth(points, barycentricCoords);
                 
                 int zBufferIndex = xPos + (yPos * image.get_width());
                 float currentZAtPosition = zBuffer[zBufferIndex];
-                if (currentZAtPosition < zPos) {
-                    zBuffer[zBufferIndex] = zPos;
-                    
-                    Vector2f uv(0,0);
-                    for (int i = 0; i < 3; ++i) {
-                        uv.u += texCoords[i].u * barycentricCoords[i];
-                        uv.v += texCoords[i].v * barycentricCoords[i];
+                bool passesDepthTest = (depthTest == DepthTest::Equal) ? (currentZAtPosition == zPos)
+                                                                       : (currentZAtPosition < zPos);
+                if (passesDepthTest) {
+                    if (depthTest == DepthTest::Greater) {
+                        zBuffer[zBufferIndex] = zPos;
                     }
                     
-                    Vector2i colorPos((int)std::round(uv.u * diffuseTexture.get_width()),
-                                      (int)std::round(uv.v * diffuseTexture.get_height()));
-                    TGAColor color = diffuseTexture.get(colorPos.x, colorPos.y);
-                    
+                    TGAColor color = shadeFragment(texCoords, barycentricCoords, diffuseTexture);
                     image.set(xPos, yPos, color);
                 }
             }
@@ -144,6 +218,227 @@ void triangle(const Vector3f points[3], const Vector2f texCoords[3], const TGAIm
     }
 }
 
+// Same coverage and depth as triangle(), but never touches UVs, textures or the colour buffer.
+// Used for Z-prepasses and for rendering standalone depth/shadow maps.
+void triangleDepthOnly(const Vector3f points[3], int imageWidth, int imageHeight, float* zBuffer) {
+    const ScreenRect rect = getScreenBoundsForTriangle(points, imageWidth, imageHeight);
+    
+    for (int xPos = rect.minX; xPos <= rect.maxX; ++xPos) {
+        for (int yPos = rect.minY; yPos <= rect.maxY; ++yPos) {
+            Vector3f screenPoint(xPos, yPos, 0);
+            Vector3f barycentricCoords = getBarycentricCoordinatesForScreenPoint(points[0], points[1], points[2], screenPoint);
+            bool isPointInsideTriangle =    (barycentricCoords.x >= 0)
+                                         && (barycentricCoords.y >= 0)
+                                         && (barycentricCoords.z >= 0);
+            
+            if (isPointInsideTriangle) {
+                float zPos = interpolateDepth(points, barycentricCoords);
+                
+                int zBufferIndex = xPos + (yPos * imageWidth);
+                if (zBuffer[zBufferIndex] < zPos) {
+                    zBuffer[zBufferIndex] = zPos;
+                }
+            }
+        }
+    }
+}
+
+// The sample counts getSamplePattern() has patterns for
+bool isSupportedSampleCount(int sampleCount) {
+    return sampleCount == 1 || sampleCount == 4 || sampleCount == 8;
+}
+
+// Colour and depth for several samples per pixel, stored pixel by pixel (all of a pixel's samples are adjacent).
+// Colours are TGAColor::val, since every sample has the image's bytes per pixel anyway.
+struct MultisampleBuffer {
+    int width;
+    int height;
+    int sampleCount;
+    std::vector<float> sampleDepths;
+    std::vector<uint32_t> sampleColors;
+    
+    MultisampleBuffer(int width, int height, int sampleCount)
+    : width(width)
+    , height(height)
+    , sampleCount(sampleCount)
+    , sampleDepths(width * height * sampleCount, std::numeric_limits<float>::lowest())
+    , sampleColors(width * height * sampleCount, 0)
+    {
+        assert(isSupportedSampleCount(sampleCount));
+    }
+    
+    void clear() {
+        std::fill(sampleDepths.begin(), sampleDepths.end(), std::numeric_limits<float>::lowest());
+        std::fill(sampleColors.begin(), sampleColors.end(), 0);
+    }
+};
+
+// Sample offsets from the pixel's integer coordinate, in the standard D3D 4x/8x rotated-grid patterns, or a single
+// sample at the pixel coordinate itself for 1x. Returns null for any other count.
+const Vector2f* getSamplePattern(int sampleCount) {
+    static const Vector2f SinglePattern[1] = { Vector2f(0.f, 0.f) };
+    static const Vector2f Pattern4x[4] = {
+        Vector2f(-2.f/16, -6.f/16), Vector2f( 6.f/16, -2.f/16), Vector2f(-6.f/16,  2.f/16), Vector2f( 2.f/16,  6.f/16),
+    };
+    static const Vector2f Pattern8x[8] = {
+        Vector2f( 1.f/16, -3.f/16), Vector2f(-1.f/16,  3.f/16), Vector2f( 5.f/16,  1.f/16), Vector2f(-3.f/16, -5.f/16),
+        Vector2f(-5.f/16,  5.f/16), Vector2f(-7.f/16, -1.f/16), Vector2f( 3.f/16,  7.f/16), Vector2f( 7.f/16, -7.f/16),
+    };
+    switch (sampleCount) {
+        case 1: return SinglePattern;
+        case 4: return Pattern4x;
+        case 8: return Pattern8x;
+        default: return nullptr;
+    }
+}
+
+// getBarycentricCoordinatesForScreenPoint() rearranged into three linear functions of the offset from the
+// triangle's first point. Setting them up costs about as much as one call to it; after that, the coordinates
+// anywhere are two multiply-adds each.
+struct BarycentricPlanes {
+    Vector3f origin; // Screen position of points[0], where the coordinates are (1, 0, 0)
+    float dx[3];     // Change in each coordinate per pixel along x
+    float dy[3];     // ...and along y
+    
+    // Returns false if the triangle has (next to) no area, which getBarycentricCoordinatesForScreenPoint() treats
+    // as covering nothing
+    bool setup(const Vector3f points[3]) {
+        const float abX = points[1].x - points[0].x;
+        const float abY = points[1].y - points[0].y;
+        const float acX = points[2].x - points[0].x;
+        const float acY = points[2].y - points[0].y;
+        const float area = (acX * abY) - (abX * acY);
+        if (std::abs(area) < std::numeric_limits<float>::epsilon()) {
+            return false;
+        }
+        
+        origin = points[0];
+        dx[1] = -acY / area;
+        dy[1] =  acX / area;
+        dx[2] =  abY / area;
+        dy[2] = -abX / area;
+        dx[0] = -(dx[1] + dx[2]);
+        dy[0] = -(dy[1] + dy[2]);
+        return true;
+    }
+    
+    // How much the coordinates change over a step of (x, y)
+    Vector3f getChange(float x, float y) const {
+        return Vector3f((dx[0] * x) + (dy[0] * y), (dx[1] * x) + (dy[1] * y), (dx[2] * x) + (dy[2] * y));
+    }
+    
+    Vector3f at(float x, float y) const {
+        const Vector3f change = getChange(x - origin.x, y - origin.y);
+        return Vector3f(1.f + change.x, change.y, change.z);
+    }
+};
+
+// Coverage and depth are tested at every sample, but the texture is looked up once per pixel and the result
+// copied to all of the samples the triangle won. Passing no texture makes this a depth-only (prepass) kernel.
+void triangleMultisample(const Vector3f points[3], const Vector2f texCoords[3], const TGAImage* diffuseTexture, MultisampleBuffer &buffer, DepthTest depthTest) {
+    BarycentricPlanes planes;
+    if (!planes.setup(points)) {
+        return;
+    }
+    const ScreenRect rect = getScreenBoundsForTriangle(points, buffer.width, buffer.height);
+    
+    // The sample pattern is the same for every pixel, so so is each sample's offset from the pixel's coordinates
+    const Vector2f* samplePattern = getSamplePattern(buffer.sampleCount);
+    if (!samplePattern) {
+        return;
+    }
+    Vector3f sampleOffsets[8];
+    for (int sample = 0; sample < buffer.sampleCount; ++sample) {
+        sampleOffsets[sample] = planes.getChange(samplePattern[sample].x, samplePattern[sample].y);
+    }
+    
+    for (int yPos = rect.minY; yPos <= rect.maxY; ++yPos) {
+        for (int xPos = rect.minX; xPos <= rect.maxX; ++xPos) {
+            const int firstSampleIndex = (xPos + (yPos * buffer.width)) * buffer.sampleCount;
+            const Vector3f pixelCoords = planes.at(xPos, yPos);
+            unsigned int coverageMask = 0;
+            Vector3f firstCoveredBarycentricCoords;
+            
+            for (int sample = 0; sample < buffer.sampleCount; ++sample) {
+                const Vector3f barycentricCoords(pixelCoords.x + sampleOffsets[sample].x,
+                                                 pixelCoords.y + sampleOffsets[sample].y,
+                                                 pixelCoords.z + sampleOffsets[sample].z);
+                bool isSampleInsideTriangle =    (barycentricCoords.x >= 0)
+                                              && (barycentricCoords.y >= 0)
+                                              && (barycentricCoords.z >= 0);
+                if (!isSampleInsideTriangle) {
+                    continue;
+                }
+                
+                float zPos = interpolateDepth(points, barycentricCoords);
+                float &currentZAtSample = buffer.sampleDepths[firstSampleIndex + sample];
+                bool passesDepthTest = (depthTest == DepthTest::Equal) ? (currentZAtSample == zPos)
+                                                                       : (currentZAtSample < zPos);
+                if (!passesDepthTest) {
+                    continue;
+                }
+                if (depthTest == DepthTest::Greater) {
+                    currentZAtSample = zPos;
+                }
+                if (coverageMask == 0) {
+                    firstCoveredBarycentricCoords = barycentricCoords;
+                }
+                coverageMask |= (1u << sample);
+            }
+            
+            if (coverageMask == 0 || !diffuseTexture) {
+                continue;
+            }
+            
+            // Shade at the pixel coordinate if it's inside the triangle, like the 1x path does. Along edges it
+            // may not be, and extrapolated UVs can land on a different part of the texture, so use a sample the
+            // triangle actually covers instead.
+            const bool isPixelInsideTriangle = (pixelCoords.x >= 0) && (pixelCoords.y >= 0) && (pixelCoords.z >= 0);
+            const Vector3f &shadingCoords = isPixelInsideTriangle ? pixelCoords : firstCoveredBarycentricCoords;
+            const uint32_t color = shadeFragment(texCoords, shadingCoords, *diffuseTexture).val;
+            for (int sample = 0; sample < buffer.sampleCount; ++sample) {
+                if (coverageMask & (1u << sample)) {
+                    buffer.sampleColors[firstSampleIndex + sample] = color;
+                }
+            }
+        }
+    }
+}
+
+// Box-filters each pixel's samples down into image, which must be the same size as the buffer
+void resolveMultisampleBuffer(const MultisampleBuffer &buffer, TGAImage &image) {
+    assert(image.get_width() == buffer.width && image.get_height() == buffer.height);
+    const int bytesPerPixel = image.get_bytespp();
+    unsigned char* imageData = image.buffer();
+    const int sampleCount = buffer.sampleCount;
+    
+    const int numPixels = buffer.width * buffer.height;
+    for (int pixel = 0; pixel < numPixels; ++pixel) {
+        const uint32_t* samples = &buffer.sampleColors[pixel * sampleCount];
+        unsigned char* destination = imageData + (pixel * bytesPerPixel);
+        
+        // Most pixels are inside a single triangle, so all of their samples match and there's nothing to average
+        bool areSamplesEqual = true;
+        for (int sample = 1; sample < sampleCount && areSamplesEqual; ++sample) {
+            areSamplesEqual = (samples[sample] == samples[0]);
+        }
+        if (areSamplesEqual) {
+            memcpy(destination, &samples[0], bytesPerPixel);
+            continue;
+        }
+        
+        // Byte n of val is TGAColor::raw[n]
+        const unsigned char* sampleBytes = reinterpret_cast<const unsigned char*>(samples);
+        for (int channel = 0; channel < bytesPerPixel; ++channel) {
+            int sum = 0;
+            for (int sample = 0; sample < sampleCount; ++sample) {
+                sum += sampleBytes[(sample * sizeof(uint32_t)) + channel];
+            }
+            destination[channel] = static_cast<unsigned char>((sum + sampleCount / 2) / sampleCount);
+        }
+    }
+}
+
 void drawHeadWireframe(TGAImage &image) {
     ObjModel model;
     model.loadFromFile("obj/head.obj");
@@ -163,35 +458,230 @@ void drawHeadWireframe(TGAImage &image) {
     }
 }
 
-void drawHeadShaded(TGAImage &image, float* zBuffer) {
+// Model is ObjModel or CompactModel
+template<typename Model>
+void getFaceScreenCoords(const Model &model, const ModelFace &face, const ViewRect &view, int imageWidth, int imageHeight, Vector3f faceScreenCoords[3], Vector2f faceTextureCoords[3]) {
+    for (int iCoord = 0; iCoord < 3; ++iCoord) {
+        ModelVertex modelVertex = face.vertices[iCoord];
+        Vector3f worldCoords = model.vertexAtIndex(modelVertex.positionIndex);
+        
+        if (faceTextureCoords) {
+            faceTextureCoords[iCoord] = model.texCoordAtIndex(modelVertex.texCoordIndex);
+        }
+        
+        float xPos = (worldCoords.x - view.minX) * imageWidth / (view.maxX - view.minX);
+        float yPos = (worldCoords.y - view.minY) * imageHeight / (view.maxY - view.minY);
+        float zPos = worldCoords.z;
+        faceScreenCoords[iCoord] = Vector3f(xPos, yPos, zPos);
+    }
+}
+
+float getProjectedSize(const BoundingBox &bounds, const ViewRect &view, int imageWidth, int imageHeight) {
+    float projectedWidth = (bounds.max.x - bounds.min.x) * imageWidth / (view.maxX - view.minX);
+    float projectedHeight = (bounds.max.y - bounds.min.y) * imageHeight / (view.maxY - view.minY);
+    return std::max(projectedWidth, projectedHeight);
+}
+
+// transform places the BVH's model in the world; the view is culled against in the model's own space instead,
+// so the BVH doesn't need rebuilding per placement
+FrameVector<int> getVisibleFaces(const ModelBVH &bvh, const ViewRect &view, const Transform &transform = Transform::identity()) {
+    // The projection is orthographic along z, so the view frustum is just the four sides of the view rect
+    std::vector<Plane> frustumPlanes = {
+        { Vector3f( 1.f, 0.f, 0.f), -view.minX },
+        { Vector3f(-1.f, 0.f, 0.f),  view.maxX },
+        { Vector3f(0.f,  1.f, 0.f), -view.minY },
+        { Vector3f(0.f, -1.f, 0.f),  view.maxY },
+    };
+    // n.(Mp + t) + d = (M^T n).p + (n.t + d). The normal doesn't have to stay unit length for an inside/outside test.
+    for (Plane &plane : frustumPlanes) {
+        const Vector3f worldNormal = plane.normal;
+        plane.normal = Vector3f(worldNormal.dot(transform.xAxis), worldNormal.dot(transform.yAxis), worldNormal.dot(transform.zAxis));
+        plane.distance += worldNormal.dot(transform.translation);
+    }
+    
+    FrameVector<int> visibleFaces;
+    bvh.getFacesInsidePlanes(frustumPlanes, visibleFaces);
+    return visibleFaces;
+}
+
+// Everything about the head that stays the same from one render to the next, so that a batch of frames only
+// loads and preprocesses it once
+class HeadScene {
+public:
+    HeadScene() = default;
+    // The LOD chain and BVHs point back into the meshes
+    HeadScene(const HeadScene &) = delete;
+    HeadScene &operator=(const HeadScene &) = delete;
+    
+    // Any textured OBJ can stand in for the head. With useLevelsOfDetail, simplified copies are built too, and
+    // prepareForView() picks one to suit how big the model is on screen. Returns false if either file couldn't be
+    // loaded, or the mesh is empty or refers to vertices it doesn't have.
+    bool load(const std::string &modelPath = "obj/head.obj", const std::string &texturePath = "obj/head_diffuse.tga",
+              bool useLevelsOfDetail = UseLevelsOfDetail) {
+        if (!m_model.loadFromFile(modelPath, OptimizeMeshLayout) || m_model.numFaces() == 0
+            || !m_texture.read_tga_file(texturePath.c_str())) {
+            return false;
+        }
+        m_texture.flip_vertically();
+        m_bounds = m_model.bounds();
+        
+        // Simplified levels keep the source's UV layout, so they can all share the one texture
+        m_useLevelsOfDetail = useLevelsOfDetail;
+        if (useLevelsOfDetail) {
+            m_lodChain.build(m_model);
+            m_levelFaceCounts = m_lodChain.levelFaceCounts();
+        } else {
+            m_levelFaceCounts = { m_model.numFaces() };
+        }
+        const int numLevels = static_cast<int>(m_levelFaceCounts.size());
+        m_levelBVHs = std::vector<ModelBVH>(numLevels);
+        
+        if (UseCompactMeshes) {
+            // The compact copies replace the full-precision meshes rather than sitting next to them: the BVHs are
+            // built over them, and everything they were made from is released
+            m_compactLevels.clear();
+            m_compactLevels.reserve(numLevels);
+            for (int levelIndex = 0; levelIndex < numLevels; ++levelIndex) {
+                m_compactLevels.emplace_back(getLevel(levelIndex));
+            }
+            m_lodChain = ModelLODChain();
+            m_model = ObjModel();
+            for (int levelIndex = 0; levelIndex < numLevels; ++levelIndex) {
+                m_levelBVHs[levelIndex].build(m_compactLevels[levelIndex]);
+            }
+        } else {
+            for (int levelIndex = 0; levelIndex < numLevels; ++levelIndex) {
+                m_levelBVHs[levelIndex].build(getLevel(levelIndex));
+            }
+        }
+        return true;
+    }
+    
+    const TGAImage &texture() const { return m_texture; }
+    
+    // Picks which level of detail to draw for this view at this image size, and which of its faces are inside the
+    // view. Returns the level's index.
+    int prepareForView(const ViewRect &view, int imageWidth, int imageHeight, FrameVector<int> &outVisibleFaces) const {
+        return prepareInstanceForView(Transform::identity(), view, imageWidth, imageHeight, outVisibleFaces);
+    }
+    
+    // The same for a copy of the head placed in the world by transform. Each placement gets its own level of
+    // detail and culling, but they all share the one set of meshes and BVHs.
+    int prepareInstanceForView(const Transform &transform, const ViewRect &view, int imageWidth, int imageHeight, FrameVector<int> &outVisibleFaces) const {
+        // A scene that failed to load has nothing to show
+        if (m_levelBVHs.empty()) {
+            outVisibleFaces.clear();
+            return 0;
+        }
+        
+        int levelIndex = 0;
+        if (m_useLevelsOfDetail) {
+            const float projectedSize = getProjectedSize(transform.apply(m_bounds), view, imageWidth, imageHeight);
+            levelIndex = getLevelIndexForScreenSize(m_levelFaceCounts, projectedSize);
+        }
+        
+        // Only faces whose bounds overlap the view make it past here; everything else is rejected a subtree at a time
+        outVisibleFaces = getVisibleFaces(m_levelBVHs[levelIndex], view, transform);
+        return levelIndex;
+    }
+    
+    // Only there if UseCompactMeshes isn't set
+    const ObjModel &getLevel(int levelIndex) const {
+        assert(m_model.numFaces() > 0);
+        return m_useLevelsOfDetail ? m_lodChain.levelAtIndex(levelIndex) : m_model;
+    }
+    
+    // Only there if UseCompactMeshes is set. Same faces in the same order as getLevel(levelIndex) had.
+    const CompactModel &getCompactLevel(int levelIndex) const {
+        return m_compactLevels[levelIndex];
+    }
+    
+private:
+    ObjModel m_model;
+    TGAImage m_texture;
+    BoundingBox m_bounds;
+    bool m_useLevelsOfDetail = false;
+    ModelLODChain m_lodChain;
+    std::vector<size_t> m_levelFaceCounts;     // One per level of detail
+    std::vector<CompactModel> m_compactLevels; // Likewise
+    std::vector<ModelBVH> m_levelBVHs;         // Likewise
+};
+
+// The per-pixel buffers a frame is rasterized with besides the image itself. Only the one that matches the
+// sample count exists.
+struct RenderTargets {
+    int width;
+    int height;
+    int sampleCount;
+    std::vector<float> zBuffer;
+    std::unique_ptr<MultisampleBuffer> multisampleBuffer;
+    
+    RenderTargets(int width, int height, int sampleCount)
+    : width(width)
+    , height(height)
+    , sampleCount(sampleCount)
+    {
+        assert(isSupportedSampleCount(sampleCount));
+        if (sampleCount > 1) {
+            multisampleBuffer.reset(new MultisampleBuffer(width, height, sampleCount));
+        } else {
+            zBuffer.assign(width * height, std::numeric_limits<float>::lowest());
+        }
+    }
+    
+    void clear() {
+        if (multisampleBuffer) {
+            multisampleBuffer->clear();
+        } else {
+            std::fill(zBuffer.begin(), zBuffer.end(), std::numeric_limits<float>::lowest());
+        }
+    }
+    
+    // Bytes the targets for a frame of this size take, before allocating them
+    static size_t getMemoryUsage(int width, int height, int sampleCount) {
+        const size_t numPixels = static_cast<size_t>(width) * height;
+        return (sampleCount > 1) ? numPixels * sampleCount * (sizeof(float) + sizeof(uint32_t)) : numPixels * sizeof(float);
+    }
+};
+
+// Fills in depth only, so that a following colour pass with DepthTest::Equal shades each pixel (or sample) once
+template<typename Model>
+void drawModelDepthPass(const Model &model, const FrameVector<int> &faceIndices, const ViewRect &view, RenderTargets &targets) {
+    for (int faceIndex : faceIndices) {
+        Vector3f faceScreenCoords[3];
+        getFaceScreenCoords(model, model.faceAtIndex(faceIndex), view, targets.width, targets.height, faceScreenCoords, nullptr);
+        if (targets.multisampleBuffer) {
+            triangleMultisample(faceScreenCoords, nullptr, nullptr, *targets.multisampleBuffer, DepthTest::Greater);
+        } else {
+            triangleDepthOnly(faceScreenCoords, targets.width, targets.height, targets.zBuffer.data());
+        }
+    }
+}
+
+// Returns false if the head couldn't be loaded
+bool drawHeadDepth(const ViewRect &view, RenderTargets &targets) {
     ObjModel model;
-    model.loadFromFile("obj/head.obj");
+    if (!model.loadFromFile("obj/head.obj", OptimizeMeshLayout)) {
+        return false;
+    }
     
-    TGAImage texture;
-    texture.read_tga_file("obj/head_diffuse.tga");
-    texture.flip_vertically();
+    ModelBVH bvh;
+    bvh.build(model);
     
+    drawModelDepthPass(model, getVisibleFaces(bvh, view), view, targets);
+    return true;
+}
+
+// With multisampling this draws into the sample buffer; resolveMultisampleBuffer() gets it into image afterwards
+template<typename Model>
+void drawModelColorPass(const Model &model, const FrameVector<int> &faceIndices, const TGAImage &texture, const ViewRect &view, DepthTest depthTest, RenderTargets &targets, TGAImage &image) {
     //Vector3f lightDirection(0,0,-1.f);
     
-    const size_t numFaces = model.numFaces();
-    for (int faceIndex = 0; faceIndex < numFaces; ++faceIndex) {
+    for (int faceIndex : faceIndices) {
         ModelFace face = model.faceAtIndex(faceIndex);
-        Vector3f faceWorldCoords[3];
         Vector3f faceScreenCoords[3];
         Vector2f faceTextureCoords[3];
-        for (int iCoord = 0; iCoord < 3; ++iCoord) {
-            ModelVertex modelVertex = face.vertices[iCoord];
-            Vector3f worldCoords = model.vertexAtIndex(modelVertex.positionIndex);
-            faceWorldCoords[iCoord] = worldCoords;
-            
-            Vector2f textureCoords = model.texCoordAtIndex(modelVertex.texCoordIndex);
-            faceTextureCoords[iCoord] = textureCoords;
-            
-            float xPos = (worldCoords.x + 1.f) * ImageWidth / 2.f;
-            float yPos = (worldCoords.y + 1.f) * ImageHeight / 2.f;
-            float zPos = worldCoords.z;
-            faceScreenCoords[iCoord] = Vector3f(xPos, yPos, zPos);
-        }
+        getFaceScreenCoords(model, face, view, targets.width, targets.height, faceScreenCoords, faceTextureCoords);
         
         /*
         // Calculate color for triangle
@@ -204,21 +694,583 @@ void drawHeadShaded(TGAImage &image, float* zBuffer) {
         TGAColor color(greyIntensity, greyIntensity, greyIntensity, 255);
          */
         
-        triangle(faceScreenCoords, faceTextureCoords, texture, image, zBuffer);
+        if (targets.multisampleBuffer) {
+            triangleMultisample(faceScreenCoords, faceTextureCoords, &texture, *targets.multisampleBuffer, depthTest);
+        } else {
+            triangle(faceScreenCoords, faceTextureCoords, texture, image, targets.zBuffer.data(), depthTest);
+        }
     }
 }
 
+template<typename Model>
+void drawModelShaded(const Model &model, const FrameVector<int> &faceIndices, const TGAImage &texture, const ViewRect &view, bool useDepthPrepass, RenderTargets &targets, TGAImage &image) {
+    if (useDepthPrepass) {
+        // Resolve visibility first with the cheap kernel so that the shaded pass below only does texture work
+        // for the one fragment per pixel that actually ends up on screen
+        drawModelDepthPass(model, faceIndices, view, targets);
+    }
+    const DepthTest depthTest = useDepthPrepass ? DepthTest::Equal : DepthTest::Greater;
+    drawModelColorPass(model, faceIndices, texture, view, depthTest, targets, image);
+}
+
+// Draws the scene into image, which should be cleared (as should targets)
+void drawHeadFrame(const HeadScene &scene, const ViewRect &view, bool useDepthPrepass, RenderTargets &targets, TGAImage &image) {
+    FrameVector<int> visibleFaces;
+    const int levelIndex = scene.prepareForView(view, targets.width, targets.height, visibleFaces);
+    
+    if (visibleFaces.empty()) {
+        // Nothing to draw, and the scene may not even have a level to draw it from
+    } else if (UseCompactMeshes) {
+        drawModelShaded(scene.getCompactLevel(levelIndex), visibleFaces, scene.texture(), view, useDepthPrepass, targets, image);
+    } else {
+        drawModelShaded(scene.getLevel(levelIndex), visibleFaces, scene.texture(), view, useDepthPrepass, targets, image);
+    }
+    if (targets.multisampleBuffer) {
+        resolveMultisampleBuffer(*targets.multisampleBuffer, image);
+    }
+}
+
+bool isInsideView(const BoundingBox &bounds, const ViewRect &view) {
+    return !bounds.isEmpty()
+        && bounds.max.x >= view.minX && bounds.min.x <= view.maxX
+        && bounds.max.y >= view.minY && bounds.min.y <= view.maxY;
+}
+
+// Runs one pass over the faces [firstFace, endFace) of the mesh (counting in file order) that are in chunks inside
+// the view, with only one chunk in memory at a time
+template<typename DrawChunk>
+bool forEachVisibleChunk(ChunkedMeshReader &reader, const ViewRect &view, size_t firstFace, size_t endFace, DrawChunk drawChunk) {
+    reader.rewind();
+    MeshChunkHeader chunkHeader;
+    ObjModel chunk;
+    FrameVector<int> chunkFaces;
+    size_t chunkFirstFace = 0;
+    for (size_t chunkIndex = 0; chunkIndex < reader.numChunks(); ++chunkIndex) {
+        if (!reader.readChunkHeader(chunkHeader)) {
+            return false;
+        }
+        const size_t chunkEndFace = chunkFirstFace + chunkHeader.numFaces;
+        const bool isInRange = chunkFirstFace < endFace && chunkEndFace > firstFace;
+        if (!isInRange || !isInsideView(ChunkedMeshReader::chunkBounds(chunkHeader), view)) {
+            if (!reader.skipChunk(chunkHeader)) {
+                return false;
+            }
+            chunkFirstFace = chunkEndFace;
+            continue;
+        }
+        
+        if (!reader.readChunk(chunkHeader, chunk)) {
+            return false;
+        }
+        chunkFaces.clear();
+        for (size_t face = std::max(firstFace, chunkFirstFace); face < std::min(endFace, chunkEndFace); ++face) {
+            chunkFaces.push_back(static_cast<int>(face - chunkFirstFace));
+        }
+        drawChunk(chunk, chunkFaces);
+        chunkFirstFace = chunkEndFace;
+    }
+    return true;
+}
+
+// A chunked mesh to stream from meshPath. An OBJ is converted to one next to it the first time, and that copy is
+// reused until the OBJ changes; anything else is taken to already be one. Use "--convert" instead if the OBJ's
+// directory isn't writable.
+bool prepareChunkedMesh(const std::string &meshPath, std::string &outChunkedMeshPath) {
+    outChunkedMeshPath = meshPath;
+    const std::string objExtension = ".obj";
+    if (meshPath.size() >= objExtension.size() && meshPath.compare(meshPath.size() - objExtension.size(), objExtension.size(), objExtension) == 0) {
+        outChunkedMeshPath = meshPath + ".chunks";
+        if (isChunkedMeshUpToDate(meshPath, outChunkedMeshPath)) {
+            return true;
+        }
+        if (!convertObjToChunkedMesh(meshPath, outChunkedMeshPath, StreamingFacesPerChunk)) {
+            std::cout << "Couldn't convert " << meshPath << "; try \"--convert " << meshPath << " <output path>\"" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Draws faces [firstFace, endFace) of the mesh. With multisampling the result is left in the sample buffer.
+bool drawStreamedMesh(ChunkedMeshReader &reader, size_t firstFace, size_t endFace, const TGAImage &texture, const ViewRect &view, RenderTargets &targets, TGAImage &image) {
+    if (UseDepthPrepass) {
+        // Costs a second read of the file, but the colour pass then shades each pixel once no matter how deep
+        // the model is
+        bool didDrawDepth = forEachVisibleChunk(reader, view, firstFace, endFace, [&](const ObjModel &chunk, const FrameVector<int> &faces) {
+            drawModelDepthPass(chunk, faces, view, targets);
+        });
+        if (!didDrawDepth) {
+            return false;
+        }
+    }
+    const DepthTest depthTest = UseDepthPrepass ? DepthTest::Equal : DepthTest::Greater;
+    return forEachVisibleChunk(reader, view, firstFace, endFace, [&](const ObjModel &chunk, const FrameVector<int> &faces) {
+        drawModelColorPass(chunk, faces, texture, view, depthTest, targets, image);
+    });
+}
+
+// Draws a mesh too big to load whole, textured with the head's diffuse map
+bool renderStreamedMesh(const std::string &meshPath, const ViewRect &view, TGAImage &image) {
+    std::string chunkedMeshPath;
+    ChunkedMeshReader reader;
+    if (!prepareChunkedMesh(meshPath, chunkedMeshPath) || !reader.open(chunkedMeshPath)) {
+        return false;
+    }
+    
+    TGAImage texture;
+    texture.read_tga_file("obj/head_diffuse.tga");
+    texture.flip_vertically();
+    
+    RenderTargets targets(ImageWidth, ImageHeight, MultisampleCount);
+    if (!drawStreamedMesh(reader, 0, reader.numFaces(), texture, view, targets, image)) {
+        return false;
+    }
+    if (targets.multisampleBuffer) {
+        resolveMultisampleBuffer(*targets.multisampleBuffer, image);
+    }
+    return true;
+}
+
+// Every sample's colour and depth: from the sample buffer with multisampling, otherwise from image and the z-buffer
+DepthLayer getDepthLayer(const RenderTargets &targets, const TGAImage &image) {
+    DepthLayer layer;
+    if (targets.multisampleBuffer) {
+        const MultisampleBuffer &buffer = *targets.multisampleBuffer;
+        layer.depths = buffer.sampleDepths;
+        layer.colors = buffer.sampleColors;
+    } else {
+        layer.depths = targets.zBuffer;
+        layer.colors.resize(targets.width * targets.height);
+        for (int y = 0; y < targets.height; ++y) {
+            for (int x = 0; x < targets.width; ++x) {
+                layer.colors[x + (y * targets.width)] = image.get(x, y).val;
+            }
+        }
+    }
+    return layer;
+}
+
+// The reverse of getDepthLayer(), resolving the samples into image if there are several per pixel
+void applyDepthLayer(const DepthLayer &layer, RenderTargets &targets, TGAImage &image) {
+    const int bytesPerPixel = image.get_bytespp();
+    if (targets.multisampleBuffer) {
+        MultisampleBuffer &buffer = *targets.multisampleBuffer;
+        buffer.sampleDepths = layer.depths;
+        buffer.sampleColors = layer.colors;
+        resolveMultisampleBuffer(buffer, image);
+    } else {
+        targets.zBuffer = layer.depths;
+        for (int y = 0; y < targets.height; ++y) {
+            for (int x = 0; x < targets.width; ++x) {
+                image.set(x, y, TGAColor(layer.colors[x + (y * targets.width)], bytesPerPixel));
+            }
+        }
+    }
+}
+
+// Like renderStreamedMesh(), but split across numWorkers processes that each draw an equal run of the mesh's faces,
+// reading only the chunks those faces are in. The workers' images are then depth-composited (see DistributedRender.h).
+bool renderDistributedMesh(const std::string &meshPath, int numWorkers, const ViewRect &view, TGAImage &image) {
+    std::string chunkedMeshPath;
+    ChunkedMeshReader reader;
+    if (!prepareChunkedMesh(meshPath, chunkedMeshPath) || !reader.open(chunkedMeshPath)) {
+        return false;
+    }
+    const size_t numFaces = reader.numFaces();
+    
+    RenderTargets targets(ImageWidth, ImageHeight, MultisampleCount);
+    const size_t numSamples = targets.multisampleBuffer ? targets.multisampleBuffer->sampleDepths.size() : targets.zBuffer.size();
+    
+    DepthLayer composite;
+    bool didRender = renderDistributed(numWorkers, numSamples, [&](int workerIndex, int workerCount, DepthLayer &outLayer) {
+        // Workers are separate processes, so each opens the file for itself
+        ChunkedMeshReader workerReader;
+        if (!workerReader.open(chunkedMeshPath)) {
+            return false;
+        }
+        TGAImage texture;
+        texture.read_tga_file("obj/head_diffuse.tga");
+        texture.flip_vertically();
+        
+        RenderTargets workerTargets(ImageWidth, ImageHeight, MultisampleCount);
+        TGAImage workerImage(ImageWidth, ImageHeight, TGAImage::RGB);
+        const size_t firstFace = numFaces * workerIndex / workerCount;
+        const size_t endFace = numFaces * (workerIndex + 1) / workerCount;
+        if (!drawStreamedMesh(workerReader, firstFace, endFace, texture, view, workerTargets, workerImage)) {
+            return false;
+        }
+        outLayer = getDepthLayer(workerTargets, workerImage);
+        return true;
+    }, composite);
+    if (!didRender) {
+        return false;
+    }
+    
+    applyDepthLayer(composite, targets, image);
+    return true;
+}
+
+// One placement of a shared model. All of its vertices are transformed in one batch up front (into the frame
+// arena), and faces and texture coordinates are read straight from the model. It has ObjModel's accessors, so the
+// draw passes take it as is.
+template<typename Model>
+class PlacedModel {
+public:
+    PlacedModel(const Model &model, const Transform &transform)
+    : m_model(&model)
+    , m_vertices(model.numVertices())
+    {
+        for (size_t i = 0; i < m_vertices.size(); ++i) {
+            m_vertices[i] = transform.apply(model.vertexAtIndex(static_cast<int>(i)));
+        }
+    }
+    
+    size_t numFaces() const { return m_model->numFaces(); }
+    Vector3f vertexAtIndex(int index) const { return m_vertices[index]; }
+    Vector2f texCoordAtIndex(int index) const { return m_model->texCoordAtIndex(index); }
+    ModelFace faceAtIndex(int index) const { return m_model->faceAtIndex(index); }
+    
+private:
+    const Model* m_model;
+    FrameVector<Vector3f> m_vertices;
+};
+
+template<typename Model, typename GetLevel>
+void drawInstances(const HeadScene &scene, const std::vector<Transform> &instances, GetLevel getLevel, const ViewRect &view, bool useDepthPrepass, RenderTargets &targets, TGAImage &image) {
+    struct VisibleInstance {
+        PlacedModel<Model> model;
+        FrameVector<int> faces;
+    };
+    
+    // Cull (and pick a level of detail for) every instance first, so that instances entirely outside the view
+    // never get their vertices transformed
+    FrameVector<VisibleInstance> visibleInstances;
+    visibleInstances.reserve(instances.size());
+    for (const Transform &transform : instances) {
+        FrameVector<int> faces;
+        const int levelIndex = scene.prepareInstanceForView(transform, view, targets.width, targets.height, faces);
+        if (faces.empty()) {
+            continue;
+        }
+        visibleInstances.push_back({ PlacedModel<Model>(getLevel(levelIndex), transform), std::move(faces) });
+    }
+    
+    // Every instance shares the one set of render targets, so depth testing between instances just works
+    if (useDepthPrepass) {
+        for (const VisibleInstance &instance : visibleInstances) {
+            drawModelDepthPass(instance.model, instance.faces, view, targets);
+        }
+    }
+    const DepthTest depthTest = useDepthPrepass ? DepthTest::Equal : DepthTest::Greater;
+    for (const VisibleInstance &instance : visibleInstances) {
+        drawModelColorPass(instance.model, instance.faces, scene.texture(), view, depthTest, targets, image);
+    }
+}
+
+// Draws a copy of the scene's head for every transform, which like drawHeadFrame() should start out cleared
+void drawInstancedFrame(const HeadScene &scene, const std::vector<Transform> &instances, const ViewRect &view, bool useDepthPrepass, RenderTargets &targets, TGAImage &image) {
+    if (UseCompactMeshes) {
+        auto getLevel = [&](int levelIndex) -> const CompactModel & { return scene.getCompactLevel(levelIndex); };
+        drawInstances<CompactModel>(scene, instances, getLevel, view, useDepthPrepass, targets, image);
+    } else {
+        auto getLevel = [&](int levelIndex) -> const ObjModel & { return scene.getLevel(levelIndex); };
+        drawInstances<ObjModel>(scene, instances, getLevel, view, useDepthPrepass, targets, image);
+    }
+    if (targets.multisampleBuffer) {
+        resolveMultisampleBuffer(*targets.multisampleBuffer, image);
+    }
+}
+
+// numInstances heads on a square grid filling the full view, each turned a little further than the last
+std::vector<Transform> getInstanceGrid(int numInstances) {
+    const int gridSize = std::max(1, static_cast<int>(std::ceil(std::sqrt(static_cast<float>(numInstances)))));
+    const float cellSize = (FullView.maxX - FullView.minX) / gridSize;
+    
+    std::vector<Transform> instances;
+    for (int i = 0; i < numInstances; ++i) {
+        Vector3f cellCenter(FullView.minX + cellSize * ((i % gridSize) + 0.5f),
+                            FullView.maxY - cellSize * ((i / gridSize) + 0.5f),
+                            0.f);
+        // The head fills [-1,1], so half a cell is exactly one cell wide; leave a little room for the turn
+        instances.push_back(Transform::placement(cellCenter, cellSize * 0.45f, i * 0.4f));
+    }
+    return instances;
+}
+
+// A slow zoom from the whole head in to its face
+ViewRect getAnimationView(int frameIndex, int numFrames) {
+    const ViewRect FinalView = { -0.45f, -0.25f, 0.45f, 0.65f };
+    float t = (numFrames > 1) ? static_cast<float>(frameIndex) / (numFrames - 1) : 0.f;
+    ViewRect view;
+    view.minX = FullView.minX + (FinalView.minX - FullView.minX) * t;
+    view.minY = FullView.minY + (FinalView.minY - FullView.minY) * t;
+    view.maxX = FullView.maxX + (FinalView.maxX - FullView.maxX) * t;
+    view.maxY = FullView.maxY + (FinalView.maxY - FullView.maxY) * t;
+    return view;
+}
+
+// Renders frame_0000.tga, frame_0001.tga, ... While one frame rasterizes here, the ones before it are being
+// flipped, encoded and written by the pipeline's threads.
+bool renderHeadAnimation(int numFrames) {
+    HeadScene scene;
+    if (!scene.load()) {
+        std::cout << "Couldn't load obj/head.obj and obj/head_diffuse.tga" << std::endl;
+        return false;
+    }
+    
+    RenderTargets targets(ImageWidth, ImageHeight, MultisampleCount);
+    FramePipeline pipeline(ImageWidth, ImageHeight, TGAImage::RGB);
+    for (int frameIndex = 0; frameIndex < numFrames; ++frameIndex) {
+        TGAImage &image = pipeline.beginFrame();
+        targets.clear();
+        drawHeadFrame(scene, getAnimationView(frameIndex, numFrames), UseDepthPrepass, targets, image);
+        // Everything the frame allocated from the arena (face lists, BVH traversal) is dead by now
+        FrameArena::forCurrentThread().reset();
+        
+        std::ostringstream filePath;
+        filePath << "frame_" << std::setw(4) << std::setfill('0') << frameIndex << ".tga";
+        pipeline.submitFrame(filePath.str());
+    }
+    return pipeline.finish();
+}
+
+// The assets the render server has loaded so far, kept for the life of the process. Scenes are only ever added,
+// and only read once loaded, so render threads can share them without holding the lock.
+class SceneCache {
+public:
+    // asset is "head" or an OBJ path, which then needs a texture. Each asset is loaded once, outside the lock, so a
+    // cold load only holds up requests for that same asset. Assets that fail to load aren't cached.
+    std::shared_ptr<const HeadScene> get(const std::string &asset, const std::string &texturePath, std::string &outError) {
+        // The head always uses its own texture, so any texture sent with it mustn't make a second copy
+        const std::string key = (asset == "head") ? asset : asset + "|" + texturePath;
+        std::promise<std::shared_ptr<const HeadScene>> loadPromise;
+        std::shared_future<std::shared_ptr<const HeadScene>> scene;
+        bool shouldLoad = false;
+        uint64_t loadId = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto cachedScene = m_entries.find(key);
+            if (cachedScene != m_entries.end()) {
+                cachedScene->second.lastUse = ++m_useCounter;
+                scene = cachedScene->second.scene;
+            } else {
+                scene = loadPromise.get_future().share();
+                loadId = ++m_useCounter;
+                m_entries[key] = { scene, loadId, loadId };
+                shouldLoad = true;
+                evictLeastRecentlyUsed();
+            }
+        }
+        
+        if (shouldLoad) {
+            std::shared_ptr<HeadScene> loadedScene(new HeadScene());
+            bool didLoad;
+            if (asset == "head") {
+                didLoad = loadedScene->load("obj/head.obj", "obj/head_diffuse.tga", ServerUsesLevelsOfDetail);
+            } else {
+                didLoad = !texturePath.empty() && loadedScene->load(asset, texturePath, ServerUsesLevelsOfDetail);
+            }
+            if (!didLoad) {
+                loadedScene.reset();
+                // Unless it's already been evicted (and maybe requested again since)
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto entry = m_entries.find(key);
+                if (entry != m_entries.end() && entry->second.loadId == loadId) {
+                    m_entries.erase(entry);
+                }
+            }
+            loadPromise.set_value(std::move(loadedScene));
+        }
+        
+        std::shared_ptr<const HeadScene> loadedScene = scene.get();
+        if (!loadedScene) {
+            outError = "couldn't load asset " + asset;
+        }
+        return loadedScene;
+    }
+    
+private:
+    // Clients choose the paths, so without a limit they could make the server load models until it runs out of
+    // memory. Renders still using an evicted scene keep it alive until they finish.
+    static const size_t MaxCachedScenes = 8;
+    
+    struct Entry {
+        std::shared_future<std::shared_ptr<const HeadScene>> scene;
+        uint64_t loadId;
+        uint64_t lastUse;
+    };
+    
+    void evictLeastRecentlyUsed() {
+        while (m_entries.size() > MaxCachedScenes) {
+            auto leastRecentlyUsed = m_entries.begin();
+            for (auto entry = m_entries.begin(); entry != m_entries.end(); ++entry) {
+                if (entry->second.lastUse < leastRecentlyUsed->second.lastUse) {
+                    leastRecentlyUsed = entry;
+                }
+            }
+            m_entries.erase(leastRecentlyUsed);
+        }
+    }
+    
+    std::mutex m_mutex;
+    std::map<std::string, Entry> m_entries;
+    uint64_t m_useCounter = 0;
+};
+
+// What one render may allocate for its targets. Every pool thread can be rendering at once, so this times the
+// thread count is the server's worst case. At 4x MSAA it allows up to 2048x2048.
+const size_t MaxServerRenderTargetBytes = 128 * 1024 * 1024;
+// Targets up to this size (which covers 800x800 at 4x) are kept for the thread's next request. Bigger ones are
+// freed straight after, so that one large request doesn't leave its memory pinned to a pool thread.
+const size_t RetainedServerRenderTargetBytes = 32 * 1024 * 1024;
+// Likewise for the thread's frame arena, which a big request can grow well past what an ordinary frame uses
+const size_t RetainedServerArenaBytes = 4 * 1024 * 1024;
+
+bool renderServerRequest(SceneCache &sceneCache, const RenderRequest &request, TGAImage &image, std::string &outError) {
+    const size_t targetBytes = RenderTargets::getMemoryUsage(request.width, request.height, MultisampleCount);
+    if (targetBytes > MaxServerRenderTargetBytes) {
+        // Round up, so that a size just over the limit doesn't claim to need exactly the limit
+        const size_t MegaByte = 1024 * 1024;
+        outError = "size needs " + std::to_string((targetBytes + MegaByte - 1) / MegaByte) + " MB of render targets, more than the "
+                 + std::to_string(MaxServerRenderTargetBytes / MegaByte) + " MB allowed";
+        return false;
+    }
+    
+    const std::shared_ptr<const HeadScene> scene = sceneCache.get(request.asset, request.texture, outError);
+    if (!scene) {
+        return false;
+    }
+    
+    // Each render thread keeps its own targets, and only reallocates them when the requested size changes
+    thread_local std::unique_ptr<RenderTargets> targets;
+    if (!targets || targets->width != request.width || targets->height != request.height) {
+        targets.reset();
+        targets.reset(new RenderTargets(request.width, request.height, MultisampleCount));
+    } else {
+        targets->clear();
+    }
+    
+    const ViewRect view = { request.viewMinX, request.viewMinY, request.viewMaxX, request.viewMaxY };
+    drawHeadFrame(*scene, view, UseDepthPrepass, *targets, image);
+    FrameArena &arena = FrameArena::forCurrentThread();
+    arena.reset();
+    arena.trim(RetainedServerArenaBytes);
+    if (targetBytes > RetainedServerRenderTargetBytes) {
+        targets.reset();
+    }
+    return true;
+}
+
+// Keeps the head loaded and serves renders over a Unix socket until killed (see RenderServer.h for the protocol)
+void serveRenders(const std::string &socketPath) {
+    SceneCache sceneCache;
+    std::string error;
+    if (!sceneCache.get("head", "", error)) {
+        std::cerr << error << std::endl;
+        return;
+    }
+    
+    const int numThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    RenderServer server([&sceneCache](const RenderRequest &request, TGAImage &image, std::string &outError) {
+        return renderServerRequest(sceneCache, request, image, outError);
+    }, numThreads, numThreads * 2);
+    server.run(socketPath);
+}
+
+TGAImage depthBufferToImage(const float* zBuffer, int width, int height) {
+    // Map the model's [-1,1] depth range onto [0,255]; pixels nothing was drawn to stay black
+    TGAImage depthImage(width, height, TGAImage::GRAYSCALE);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            float z = zBuffer[x + (y * width)];
+            if (z == std::numeric_limits<float>::lowest()) {
+                continue;
+            }
+            int grey = static_cast<int>((clamp(z, -1.f, 1.f) + 1.f) * 0.5f * 255.f);
+            depthImage.set(x, y, TGAColor(grey, 1));
+        }
+    }
+    return depthImage;
+}
+
 
 int main(int argc, char** argv) {
+    const std::string mode = (argc > 1) ? argv[1] : "";
+    
+    // "--depth" renders only the z-buffer (e.g. for shadow maps or depth analysis) and writes it out as greyscale
+    if (mode == "--depth") {
+        RenderTargets targets(ImageWidth, ImageHeight, 1);
+        if (!drawHeadDepth(FullView, targets)) {
+            std::cout << "Couldn't load obj/head.obj" << std::endl;
+            return 1;
+        }
+        
+        TGAImage depthImage = depthBufferToImage(targets.zBuffer.data(), ImageWidth, ImageHeight);
+        depthImage.flip_vertically();
+        depthImage.write_tga_file("depth.tga");
+        return 0;
+    }
+    
+    // "--serve <socket path>" runs as a render server instead of rendering once
+    if (mode == "--serve" && argc > 2) {
+        serveRenders(argv[2]);
+        return 1;
+    }
+    
+    // "--frames N" renders an N frame animation through the pipelined frame loop
+    if (mode == "--frames" && argc > 2) {
+        return renderHeadAnimation(std::atoi(argv[2])) ? 0 : 1;
+    }
+    
     TGAImage image(ImageWidth, ImageHeight, TGAImage::RGB);
     
-    const size_t zBufferSize = ImageWidth * ImageHeight;
-    float zBuffer[zBufferSize];
-    for (int i = 0; i < zBufferSize; ++i) {
-        zBuffer[i] = std::numeric_limits<float>::lowest();
+    // "--instances N" draws N copies of the head from the one shared model
+    if (mode == "--instances" && argc > 2) {
+        HeadScene scene;
+        if (!scene.load()) {
+            std::cout << "Couldn't load obj/head.obj and obj/head_diffuse.tga" << std::endl;
+            return 1;
+        }
+        RenderTargets targets(ImageWidth, ImageHeight, MultisampleCount);
+        drawInstancedFrame(scene, getInstanceGrid(std::atoi(argv[2])), FullView, UseDepthPrepass, targets, image);
+        
+        image.flip_vertically();
+        image.write_tga_file("output.tga");
+        return 0;
     }
-
-    drawHeadShaded(image, zBuffer);
+    
+    // "--convert <obj path> <output path>" writes a chunked mesh for "--stream" and "--distributed" to read
+    if (mode == "--convert" && argc > 3) {
+        return convertObjToChunkedMesh(argv[2], argv[3], StreamingFacesPerChunk) ? 0 : 1;
+    }
+    
+    // "--distributed N <path>" draws a mesh like "--stream", but across N worker processes
+    if (mode == "--distributed" && argc > 3) {
+        if (!renderDistributedMesh(argv[3], std::atoi(argv[2]), FullView, image)) {
+            return 1;
+        }
+        image.flip_vertically();
+        image.write_tga_file("output.tga");
+        return 0;
+    }
+    
+    // "--stream <path>" draws a mesh from disk a chunk at a time instead of loading it all (see ChunkedMesh.h)
+    if (mode == "--stream" && argc > 2) {
+        if (!renderStreamedMesh(argv[2], FullView, image)) {
+            return 1;
+        }
+        image.flip_vertically();
+        image.write_tga_file("output.tga");
+        return 0;
+    }
+    
+    HeadScene scene;
+    if (!scene.load()) {
+        std::cout << "Couldn't load obj/head.obj and obj/head_diffuse.tga" << std::endl;
+        return 1;
+    }
+    RenderTargets targets(ImageWidth, ImageHeight, MultisampleCount);
+    drawHeadFrame(scene, FullView, UseDepthPrepass, targets, image);
 
     image.flip_vertically(); // i want to have the origin at the left bottom corner of the image
     image.write_tga_file("output.tga");
@@ -4,6 +4,7 @@
 #include <time.h>
 #include <math.h>
 #include "tgaimage.h"
+#include "FrameArena.h"
 
 TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
 }
@@ -146,9 +147,6 @@ bool TGAImage::load_rle_data(std::ifstream &in) {
 }
 
 bool TGAImage::write_tga_file(const char *filename, bool rle) {
-	unsigned char developer_area_ref[4] = {0, 0, 0, 0};
-	unsigned char extension_area_ref[4] = {0, 0, 0, 0};
-	unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
 	std::ofstream out;
 	out.open (filename, std::ios::binary);
 	if (!out.is_open()) {
@@ -156,6 +154,16 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
 		out.close();
 		return false;
 	}
+	bool succ = write_tga(out, rle);
+	out.close();
+	return succ;
+}
+
+// writes the whole file (header, pixels and footer) to any stream, e.g. a std::ostringstream to encode in memory
+bool TGAImage::write_tga(std::ostream &out, bool rle) {
+	unsigned char developer_area_ref[4] = {0, 0, 0, 0};
+	unsigned char extension_area_ref[4] = {0, 0, 0, 0};
+	unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
 	TGA_Header header;
 	memset((void *)&header, 0, sizeof(header));
 	header.bitsperpixel = bytespp<<3;
@@ -165,7 +173,6 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
 	header.imagedescriptor = 0x20; // top-left origin
 	out.write((char *)&header, sizeof(header));
 	if (!out.good()) {
-		out.close();
 		std::cerr << "can't dump the tga file\n";
 		return false;
 	}
@@ -173,12 +180,10 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
 		out.write((char *)data, width*height*bytespp);
 		if (!out.good()) {
 			std::cerr << "can't unload raw data\n";
-			out.close();
 			return false;
 		}
 	} else {
 		if (!unload_rle_data(out)) {
-			out.close();
 			std::cerr << "can't unload rle data\n";
 			return false;
 		}
@@ -186,27 +191,23 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
 	out.write((char *)developer_area_ref, sizeof(developer_area_ref));
 	if (!out.good()) {
 		std::cerr << "can't dump the tga file\n";
-		out.close();
 		return false;
 	}
 	out.write((char *)extension_area_ref, sizeof(extension_area_ref));
 	if (!out.good()) {
 		std::cerr << "can't dump the tga file\n";
-		out.close();
 		return false;
 	}
 	out.write((char *)footer, sizeof(footer));
 	if (!out.good()) {
 		std::cerr << "can't dump the tga file\n";
-		out.close();
 		return false;
 	}
-	out.close();
 	return true;
 }
 
 // TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
-bool TGAImage::unload_rle_data(std::ofstream &out) {
+bool TGAImage::unload_rle_data(std::ostream &out) {
 	const unsigned char max_chunk_length = 128;
 	unsigned long npixels = width*height;
 	unsigned long curpix = 0;
@@ -292,7 +293,9 @@ bool TGAImage::flip_horizontally() {
 bool TGAImage::flip_vertically() {
 	if (!data) return false;
 	unsigned long bytes_per_line = width*bytespp;
-	unsigned char *line = new unsigned char[bytes_per_line];
+	FrameArena &arena = FrameArena::forCurrentThread();
+	FrameArena::Scope scratch(arena);
+	unsigned char *line = arena.allocateArray<unsigned char>(bytes_per_line);
 	int half = height>>1;
 	for (int j=0; j<half; j++) {
 		unsigned long l1 = j*bytes_per_line;
@@ -301,7 +304,6 @@ bool TGAImage::flip_vertically() {
 		memmove((void *)(data+l1), (void *)(data+l2), bytes_per_line);
 		memmove((void *)(data+l2), (void *)line,      bytes_per_line);
 	}
-	delete [] line;
 	return true;
 }
 
@@ -68,7 +68,7 @@ protected:
 	int bytespp;
 
 	bool   load_rle_data(std::ifstream &in);
-	bool unload_rle_data(std::ofstream &out);
+	bool unload_rle_data(std::ostream &out);
 public:
 	enum Format {
 		GRAYSCALE=1, RGB=3, RGBA=4
@@ -79,6 +79,7 @@ public:
 	TGAImage(const TGAImage &img);
 	bool read_tga_file(const char *filename);
 	bool write_tga_file(const char *filename, bool rle=true);
+	bool write_tga(std::ostream &out, bool rle=true);
 	bool flip_horizontally();
 	bool flip_vertically();
 	bool scale(int w, int h);